@@ -0,0 +1,957 @@
+#include "Dataset.h"
+#include "NetworkReflection.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// blocks start on a cache line
+static const uint64_t DATASET_ALIGNMENT = 64;
+
+static uint64_t alignOffset(uint64_t offset) {
+  return (offset + DATASET_ALIGNMENT - 1) / DATASET_ALIGNMENT *
+         DATASET_ALIGNMENT;
+}
+
+MappedFile::MappedFile() : address(nullptr), length(0) {}
+
+MappedFile::~MappedFile() { close(); }
+
+bool MappedFile::open(std::string filename) {
+  close();
+
+  int descriptor = ::open(filename.c_str(), O_RDONLY);
+
+  if (descriptor < 0)
+    return false;
+
+  struct stat status;
+
+  if (fstat(descriptor, &status) != 0 || status.st_size == 0) {
+    ::close(descriptor);
+    return false;
+  }
+
+  void *mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED,
+                       descriptor, 0);
+
+  // the mapping keeps the file alive on its own
+  ::close(descriptor);
+
+  if (mapping == MAP_FAILED)
+    return false;
+
+  address = (const char *)mapping;
+  length = status.st_size;
+
+  return true;
+}
+
+void MappedFile::close() {
+  if (address != nullptr)
+    munmap((void *)address, length);
+
+  address = nullptr;
+  length = 0;
+}
+
+const char *MappedFile::data() const { return address; }
+
+size_t MappedFile::size() const { return length; }
+
+bool isBinaryDataset(std::string filename) {
+  std::ifstream file(filename, std::ios::in | std::ios::binary);
+
+  char magic[4];
+
+  if (!file.read(magic, sizeof(magic)))
+    return false;
+
+  return std::memcmp(magic, DATASET_MAGIC, sizeof(magic)) == 0;
+}
+
+bool Dataset::useLabels() {
+  if (labelled())
+    return true;
+
+  Size outputs = expected.cols();
+
+  if (outputs < 2)
+    return false;
+
+  std::vector<Size> classes_of(size());
+
+  for (Size sample = 0; sample < size(); sample++) {
+    auto row = expected.row(sample);
+
+    Eigen::Index label;
+    row.maxCoeff(&label);
+
+    // exactly one 1, and 0 everywhere else
+    if (row(label) != 1.0f || row.sum() != 1.0f ||
+        (row.array() != 0.0f).count() != 1)
+      return false;
+
+    classes_of[sample] = label;
+  }
+
+  labels = std::move(classes_of);
+  classes = outputs;
+  expected.resize(size(), 0);
+
+  return true;
+}
+
+bool Dataset::useSparseInputs(Scalar density) {
+  if (sparse())
+    return true;
+
+  if (inputs.size() == 0 ||
+      (inputs.array() != 0.0f).count() > density * inputs.size())
+    return false;
+
+  sparse_inputs = inputs.sparseView();
+  sparse_inputs.makeCompressed();
+  inputs.resize(size(), 0);
+
+  return true;
+}
+
+RowMatrix Dataset::denseInputs() const {
+  if (isEncoded()) {
+    RowMatrix dense(size(), inputSize());
+    readInputs(0, size(), dense);
+    return dense;
+  }
+
+  if (!sparse())
+    return inputMatrix();
+
+  return RowMatrix(sparseInputs());
+}
+
+RowMatrix Dataset::targets() const {
+  if (!labelled())
+    return expectedMatrix();
+
+  RowMatrix dense = RowMatrix::Zero(size(), classes);
+
+  for (Size sample = 0; sample < size(); sample++)
+    dense(sample, label(sample)) = 1.0f;
+
+  return dense;
+}
+
+// the samples of a data set in a fixed pseudo-random order, so that splits do
+// not follow any order the file was written in
+static std::vector<Size> shuffledSamples(const Dataset &data,
+                                         unsigned int seed) {
+  std::vector<Size> order(data.size());
+  std::iota(order.begin(), order.end(), 0);
+
+  std::mt19937 generator(seed);
+  std::shuffle(order.begin(), order.end(), generator);
+
+  return order;
+}
+
+// hold out `order[first, last)`, and keep the rest. each view is sorted, so
+// that it walks the data set's buffers front to back.
+static void holdOut(const Dataset &data, const std::vector<Size> &order,
+                    Size first, Size last, DatasetView &training,
+                    DatasetView &validation) {
+  std::vector<Size> kept(order.begin(), order.begin() + first);
+  kept.insert(kept.end(), order.begin() + last, order.end());
+
+  std::vector<Size> held(order.begin() + first, order.begin() + last);
+
+  std::sort(kept.begin(), kept.end());
+  std::sort(held.begin(), held.end());
+
+  training = DatasetView(data, std::move(kept));
+  validation = DatasetView(data, std::move(held));
+}
+
+void splitDataset(const Dataset &data, Scalar fraction, unsigned int seed,
+                  DatasetView &training, DatasetView &validation) {
+  fraction = std::min<Scalar>(std::max<Scalar>(fraction, 0.0f), 1.0f);
+
+  Size held = std::lround(data.size() * fraction);
+
+  holdOut(data, shuffledSamples(data, seed), data.size() - held, data.size(),
+          training, validation);
+}
+
+void foldDataset(const Dataset &data, Size folds, Size fold,
+                 unsigned int seed, DatasetView &training,
+                 DatasetView &validation) {
+  Size first = (size_t)data.size() * fold / folds;
+  Size last = (size_t)data.size() * (fold + 1) / folds;
+
+  holdOut(data, shuffledSamples(data, seed), first, last, training,
+          validation);
+}
+
+// bytes per stored value
+static uint64_t columnWidth(uint32_t type) {
+  switch (type) {
+  case COLUMN_FLOAT32:
+    return sizeof(float);
+  case COLUMN_FLOAT16:
+    return sizeof(Eigen::half);
+  case COLUMN_UINT8:
+    return sizeof(uint8_t);
+  default:
+    return 0;
+  }
+}
+
+typedef Eigen::Matrix<uint8_t, Eigen::Dynamic, 1> ByteColumn;
+typedef Eigen::Matrix<Eigen::half, Eigen::Dynamic, 1> HalfColumn;
+typedef Eigen::Matrix<float, Eigen::Dynamic, 1> FloatColumn;
+
+// widen stored values into `out`. the encoder checks its choices through this
+// same function, so a column it calls exact decodes to exactly the same floats.
+// `column` is a ColumnEncoding, or the EncodedInputs::Column of a data set.
+template <typename Encoding, typename Out>
+static void decodeColumn(const Encoding &column, const char *stored,
+                         Size rows, Out &&out) {
+  switch (column.type) {
+  case COLUMN_FLOAT32:
+    out = Eigen::Map<const FloatColumn>((const float *)stored, rows);
+    break;
+  case COLUMN_FLOAT16:
+    out = Eigen::Map<const HalfColumn>((const Eigen::half *)stored, rows)
+              .cast<float>();
+    break;
+  case COLUMN_UINT8:
+    out = (Eigen::Map<const ByteColumn>((const uint8_t *)stored, rows)
+               .cast<float>() *
+           column.scale)
+              .array() +
+          column.offset;
+    break;
+  }
+}
+
+void Dataset::decodeInputs(
+    Size column, Size first, Size rows,
+    Eigen::Ref<VectorT, 0, Eigen::InnerStride<>> out) const {
+  const EncodedInputs::Column &encoding = encoded.columns[column];
+
+  decodeColumn(encoding,
+               encoding.values + (size_t)first * columnWidth(encoding.type),
+               rows, out);
+}
+
+Scalar Dataset::decodeInput(Size column, Size sample) const {
+  const EncodedInputs::Column &encoding = encoded.columns[column];
+  const char *stored =
+      encoding.values + (size_t)sample * columnWidth(encoding.type);
+
+  switch (encoding.type) {
+  case COLUMN_FLOAT16:
+    return (float)*(const Eigen::half *)stored;
+  case COLUMN_UINT8:
+    return *(const uint8_t *)stored * encoding.scale + encoding.offset;
+  default:
+    return *(const float *)stored;
+  }
+}
+
+// the smallest encoding that stores every value of a column exactly
+static ColumnEncoding chooseEncoding(const FloatColumn &values) {
+  ColumnEncoding encoding = {COLUMN_FLOAT32, 1.0f, 0.0f, 0, 0};
+
+  // only the distinct values need checking
+  std::vector<float> distinct(values.data(), values.data() + values.size());
+  std::sort(distinct.begin(), distinct.end());
+  distinct.erase(std::unique(distinct.begin(), distinct.end()),
+                 distinct.end());
+
+  if (distinct.empty()) {
+    encoding.type = COLUMN_UINT8;
+    return encoding;
+  }
+
+  Size count = distinct.size();
+  FloatColumn decoded(count);
+
+  // uint8 when the values sit on an evenly spaced grid of at most 256 points,
+  // such as small integers or one-hot flags
+  if (count <= 256 && std::isfinite(distinct.back() - distinct.front())) {
+    float step = 1.0f;
+
+    if (count > 1) {
+      step = distinct.back() - distinct.front();
+      for (Size i = 1; i < count; i++)
+        step = std::min(step, distinct[i] - distinct[i - 1]);
+    }
+
+    ColumnEncoding grid = {COLUMN_UINT8, step, distinct.front(), 0, 0};
+    std::vector<uint8_t> stored(count);
+    bool fits = true;
+
+    for (Size i = 0; i < count && fits; i++) {
+      float index = std::round((distinct[i] - grid.offset) / grid.scale);
+      fits = index >= 0 && index <= 255;
+      stored[i] = fits ? (uint8_t)index : 0;
+    }
+
+    if (fits) {
+      decodeColumn(grid, (const char *)stored.data(), count, decoded);
+
+      if (Eigen::Map<const FloatColumn>(distinct.data(), count) == decoded)
+        return grid;
+    }
+  }
+
+  // fp16 when no value loses precision
+  ColumnEncoding half = {COLUMN_FLOAT16, 1.0f, 0.0f, 0, 0};
+  HalfColumn stored =
+      Eigen::Map<const FloatColumn>(distinct.data(), count).cast<Eigen::half>();
+
+  decodeColumn(half, (const char *)stored.data(), count, decoded);
+
+  if (Eigen::Map<const FloatColumn>(distinct.data(), count) == decoded)
+    return half;
+
+  return encoding;
+}
+
+static bool saveEncodedTrainingData(std::ofstream &file, DatasetHeader &header,
+                                    const Dataset &data) {
+  Size columns = header.input_size + header.output_size;
+
+  std::vector<ColumnEncoding> encodings(columns);
+  std::vector<FloatColumn> values(columns);
+
+  // column blocks follow the table, each on its own cache line
+  uint64_t offset =
+      alignOffset(header.inputs_offset + columns * sizeof(ColumnEncoding));
+
+  // labels are written out one-hot, where they encode as one byte per class
+  RowMatrix inputs = data.denseInputs();
+  RowMatrix expected = data.targets();
+
+  for (Size column = 0; column < columns; column++) {
+    if (column < header.input_size)
+      values[column] = inputs.col(column);
+    else
+      values[column] = expected.col(column - header.input_size);
+
+    encodings[column] = chooseEncoding(values[column]);
+    encodings[column].data_offset = offset;
+
+    offset = alignOffset(offset +
+                         header.samples * columnWidth(encodings[column].type));
+  }
+
+  file.write((char *)&header, sizeof(header));
+
+  file.seekp(header.inputs_offset);
+  file.write((char *)encodings.data(), columns * sizeof(ColumnEncoding));
+
+  for (Size column = 0; column < columns; column++) {
+    const ColumnEncoding &encoding = encodings[column];
+    const FloatColumn &column_values = values[column];
+
+    file.seekp(encoding.data_offset);
+
+    if (encoding.type == COLUMN_UINT8) {
+      ByteColumn stored =
+          ((column_values.array() - encoding.offset) / encoding.scale)
+              .round()
+              .cast<uint8_t>();
+      file.write((char *)stored.data(), stored.size());
+    } else if (encoding.type == COLUMN_FLOAT16) {
+      HalfColumn stored = column_values.cast<Eigen::half>();
+      file.write((char *)stored.data(), stored.size() * sizeof(Eigen::half));
+    } else {
+      file.write((char *)column_values.data(),
+                 column_values.size() * sizeof(float));
+    }
+  }
+
+  // pad the last block, so that the file ends where the table says
+  if (offset > (uint64_t)file.tellp()) {
+    file.seekp(offset - 1);
+    file.put(0);
+  }
+
+  return !file.fail();
+}
+
+bool saveBinaryTrainingData(std::string filename, const Dataset &data,
+                            bool encode) {
+  std::ofstream file(filename, std::ios::out | std::ios::binary);
+
+  if (!file.is_open()) {
+    // opening error
+    return false;
+  }
+
+  DatasetHeader header = {};
+
+  std::memcpy(header.magic, DATASET_MAGIC, sizeof(header.magic));
+  header.version = DATASET_VERSION;
+  header.dtype = encode ? DATASET_ENCODED : DATASET_FLOAT32;
+  header.input_size = data.inputSize();
+  header.output_size = data.outputSize();
+  header.samples = data.size();
+  header.inputs_offset = alignOffset(sizeof(DatasetHeader));
+
+  if (encode) {
+    bool complete = saveEncodedTrainingData(file, header, data);
+    file.close();
+    return complete;
+  }
+
+  header.expected_offset =
+      alignOffset(header.inputs_offset +
+                  header.samples * header.input_size * sizeof(Scalar));
+
+  file.write((char *)&header, sizeof(header));
+
+  // padding up to the inputs
+  file.seekp(header.inputs_offset);
+
+  // the blocks are laid out just like the data set's matrices
+  RowMatrix inputs = data.denseInputs();
+  file.write((char *)inputs.data(), inputs.size() * sizeof(Scalar));
+
+  file.seekp(header.expected_offset);
+
+  RowMatrix expected = data.targets();
+  file.write((char *)expected.data(), expected.size() * sizeof(Scalar));
+
+  bool complete = !file.fail();
+
+  file.close();
+
+  return complete;
+}
+
+bool BinaryDatasetWriter::open(std::string filename, Size input_size,
+                               Size output_size, uint64_t samples) {
+  file.open(filename, std::ios::out | std::ios::binary);
+
+  if (!file.is_open()) {
+    // opening error
+    return false;
+  }
+
+  header = {};
+
+  std::memcpy(header.magic, DATASET_MAGIC, sizeof(header.magic));
+  header.version = DATASET_VERSION;
+  header.dtype = DATASET_FLOAT32;
+  header.input_size = input_size;
+  header.output_size = output_size;
+  header.samples = samples;
+  header.inputs_offset = alignOffset(sizeof(DatasetHeader));
+  header.expected_offset = alignOffset(
+      header.inputs_offset + samples * input_size * sizeof(Scalar));
+
+  written = 0;
+
+  file.write((char *)&header, sizeof(header));
+
+  return !file.fail();
+}
+
+bool BinaryDatasetWriter::write(const Dataset &chunk) {
+  if (written + chunk.size() > header.samples)
+    return false;
+
+  RowMatrix inputs = chunk.denseInputs();
+  RowMatrix expected = chunk.targets();
+
+  // each chunk goes at its place in both blocks
+  file.seekp(header.inputs_offset +
+             written * header.input_size * sizeof(Scalar));
+  file.write((char *)inputs.data(), inputs.size() * sizeof(Scalar));
+
+  file.seekp(header.expected_offset +
+             written * header.output_size * sizeof(Scalar));
+  file.write((char *)expected.data(), expected.size() * sizeof(Scalar));
+
+  written += chunk.size();
+
+  return !file.fail();
+}
+
+bool BinaryDatasetWriter::close() {
+  bool complete = written == header.samples && !file.fail();
+
+  file.close();
+
+  return complete;
+}
+
+bool readColumnEncodings(const MappedFile &file, const DatasetHeader &header,
+                         std::vector<ColumnEncoding> &columns) {
+  Size count = header.input_size + header.output_size;
+
+  if (header.inputs_offset + count * sizeof(ColumnEncoding) > file.size())
+    return false;
+
+  columns.resize(count);
+  std::memcpy(columns.data(), file.data() + header.inputs_offset,
+              count * sizeof(ColumnEncoding));
+
+  for (const ColumnEncoding &column : columns) {
+    uint64_t width = columnWidth(column.type);
+
+    if (width == 0 ||
+        column.data_offset + header.samples * width > file.size())
+      return false;
+  }
+
+  return true;
+}
+
+void decodeSamples(const MappedFile &file, const DatasetHeader &header,
+                   const std::vector<ColumnEncoding> &columns, uint64_t first,
+                   Size rows, Dataset &data, Size row) {
+  for (Size column = 0; column < columns.size(); column++) {
+    const ColumnEncoding &encoding = columns[column];
+    const char *stored = file.data() + encoding.data_offset +
+                         first * columnWidth(encoding.type);
+
+    if (column < header.input_size)
+      decodeColumn(encoding, stored, rows,
+                   data.inputs.col(column).segment(row, rows));
+    else
+      decodeColumn(
+          encoding, stored, rows,
+          data.expected.col(column - header.input_size).segment(row, rows));
+  }
+}
+
+Dataset readBinaryTrainingData(std::string filename, Topology topology) {
+  Dataset trainingData(topology.front(), topology.back());
+
+  // shared with the data set, if it keeps its inputs encoded
+  auto file = std::make_shared<MappedFile>();
+
+  if (!file->open(filename) || file->size() < sizeof(DatasetHeader))
+    return trainingData;
+
+  DatasetHeader header;
+  std::memcpy(&header, file->data(), sizeof(header));
+
+  if (std::memcmp(header.magic, DATASET_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != DATASET_VERSION ||
+      (header.dtype != DATASET_FLOAT32 && header.dtype != DATASET_ENCODED))
+    return trainingData;
+
+  if (header.input_size != topology.front() ||
+      header.output_size != topology.back())
+    return trainingData;
+
+  if (header.dtype == DATASET_ENCODED) {
+    std::vector<ColumnEncoding> columns;
+
+    if (!readColumnEncodings(*file, header, columns))
+      return trainingData;
+
+    // a block of rows at a time, so the columns being filled stay in cache.
+    // only the expected outputs are kept, and the non-zero inputs counted.
+    const Size DECODE_ROWS = 1024;
+
+    Dataset block(header.input_size, header.output_size, DECODE_ROWS);
+    uint64_t nonzeros = 0;
+
+    trainingData.expected.resize(header.samples, header.output_size);
+
+    for (uint64_t first = 0; first < header.samples; first += DECODE_ROWS) {
+      Size rows = std::min<uint64_t>(DECODE_ROWS, header.samples - first);
+      decodeSamples(*file, header, columns, first, rows, block, 0);
+
+      trainingData.expected.middleRows(first, rows) =
+          block.expected.topRows(rows);
+      nonzeros += (block.inputs.topRows(rows).array() != 0.0f).count();
+    }
+
+    uint64_t values = header.samples * header.input_size;
+
+    if (values > 0 && nonzeros <= 0.1 * values) {
+      // mostly zero inputs take less room still in sparse form
+      trainingData.inputs.resize(header.samples, header.input_size);
+
+      for (uint64_t first = 0; first < header.samples; first += DECODE_ROWS) {
+        Size rows = std::min<uint64_t>(DECODE_ROWS, header.samples - first);
+        decodeSamples(*file, header, columns, first, rows, block, 0);
+        trainingData.inputs.middleRows(first, rows) =
+            block.inputs.topRows(rows);
+      }
+
+      trainingData.useSparseInputs();
+    } else {
+      // the inputs stay in the mapping, and are widened a batch at a time
+      trainingData.inputs.resize(header.samples, 0);
+
+      for (Size column = 0; column < header.input_size; column++) {
+        const ColumnEncoding &encoding = columns[column];
+
+        trainingData.encoded.columns.push_back(
+            {encoding.type, encoding.scale, encoding.offset,
+             file->data() + encoding.data_offset});
+        trainingData.encoded.bytes +=
+            header.samples * columnWidth(encoding.type);
+      }
+
+      trainingData.encoded.mapping = file;
+    }
+
+    trainingData.useLabels();
+
+    return trainingData;
+  }
+
+  uint64_t inputs_end = header.inputs_offset +
+                        header.samples * header.input_size * sizeof(Scalar);
+  uint64_t expected_end =
+      header.expected_offset +
+      header.samples * header.output_size * sizeof(Scalar);
+
+  if (inputs_end > file->size() || expected_end > file->size())
+    return trainingData;
+
+  // the blocks have the same layout as the data set, no parsing needed
+  trainingData.resize(header.samples);
+
+  std::memcpy(trainingData.inputs.data(), file->data() + header.inputs_offset,
+              trainingData.inputs.size() * sizeof(Scalar));
+  std::memcpy(trainingData.expected.data(),
+              file->data() + header.expected_offset,
+              trainingData.expected.size() * sizeof(Scalar));
+
+  trainingData.useLabels();
+  trainingData.useSparseInputs();
+
+  return trainingData;
+}
+
+DatasetSource::DatasetSource(const Dataset &data, Size chunk_size)
+    : data(data), chunk_size(std::max<Size>(1, chunk_size)), position(0) {}
+
+void DatasetSource::rewind() { position = 0; }
+
+bool DatasetSource::next(Dataset &chunk) {
+  if (position >= data.size()) {
+    chunk.resize(0);
+    return false;
+  }
+
+  Size rows = std::min(chunk_size, data.size() - position);
+
+  if (data.sparse()) {
+    chunk.sparse_inputs = data.sparseInputs().middleRows(position, rows);
+    chunk.inputs.resize(rows, 0);
+  } else {
+    chunk.sparse_inputs = SparseRows();
+    chunk.inputs.resize(rows, data.inputSize());
+    data.readInputs(position, rows, chunk.inputs);
+  }
+
+  chunk.expected = data.targetBatch(position, rows);
+  chunk.classes = data.classes;
+
+  if (data.labelled())
+    chunk.labels.assign(data.labelData() + position,
+                        data.labelData() + position + rows);
+
+  position += rows;
+
+  return true;
+}
+
+StreamingDataSource::StreamingDataSource(std::string filename,
+                                         Topology topology, ThreadPool &pool,
+                                         Size chunk_size, Size prefetch)
+    : filename(filename), input_size(topology.front()),
+      output_size(topology.back()), chunk_size(chunk_size < 1 ? 1 : chunk_size),
+      prefetch(prefetch < 1 ? 1 : prefetch), binary(false), open(false),
+      header(), line_number(0), reader(&pool), finished(false),
+      stopping(false), passes(0), reading(false), quitting(false),
+      fresh(false) {
+  std::ifstream file(filename, std::ios::in | std::ios::binary);
+
+  if (!file.is_open())
+    return;
+
+  if (isBinaryDataset(filename)) {
+    binary = true;
+
+    if (!file.read((char *)&header, sizeof(header)) ||
+        header.version != DATASET_VERSION ||
+        (header.dtype != DATASET_FLOAT32 && header.dtype != DATASET_ENCODED) ||
+        header.input_size != input_size || header.output_size != output_size)
+      return;
+
+    if (header.dtype == DATASET_ENCODED &&
+        (!mapping.open(filename) ||
+         !readColumnEncodings(mapping, header, columns)))
+      return;
+  }
+
+  open = true;
+
+  // start reading ahead right away, so the first chunk is ready sooner
+  start();
+}
+
+StreamingDataSource::~StreamingDataSource() {
+  stop();
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    quitting = true;
+  }
+  changed.notify_all();
+
+  reader.wait();
+}
+
+bool StreamingDataSource::isOpen() const { return open; }
+
+void StreamingDataSource::start() {
+  bool first_pass;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    failure = nullptr;
+    finished = !open;
+    stopping = false;
+    fresh = true;
+
+    if (open) {
+      passes++;
+      reading = true;
+    }
+
+    first_pass = open && passes == 1;
+  }
+
+  if (first_pass)
+    reader.runBlocking([this] { run(); });
+  else
+    changed.notify_all();
+}
+
+void StreamingDataSource::stop() {
+  std::unique_lock<std::mutex> lock(mutex);
+
+  stopping = true;
+  changed.notify_all();
+
+  // the reader stays, for the next pass
+  changed.wait(lock, [this] { return !reading; });
+
+  // keep the buffers of anything left unread
+  while (!ready.empty()) {
+    spare.push_back(std::move(ready.front()));
+    ready.pop();
+  }
+}
+
+void StreamingDataSource::rewind() {
+  // still at the first sample, no need to read it all again
+  if (fresh)
+    return;
+
+  stop();
+  start();
+}
+
+bool StreamingDataSource::next(Dataset &chunk) {
+  std::unique_lock<std::mutex> lock(mutex);
+
+  fresh = false;
+
+  changed.wait(lock, [this] { return !ready.empty() || finished; });
+
+  if (ready.empty()) {
+    chunk.resize(0);
+
+    if (failure) {
+      std::exception_ptr rethrown = failure;
+      failure = nullptr;
+      std::rethrow_exception(rethrown);
+    }
+
+    return false;
+  }
+
+  // hand the previous chunk back to the reader, and take the next one
+  std::swap(chunk, ready.front());
+  spare.push_back(std::move(ready.front()));
+  ready.pop();
+
+  lock.unlock();
+  changed.notify_all();
+
+  return true;
+}
+
+bool StreamingDataSource::readText(std::ifstream &file, Dataset &chunk,
+                                   Size row) {
+  std::string error;
+
+  while (std::getline(file, line)) {
+    line_number++;
+
+    if (parseTrainingRow(line.data(), line.data() + line.size(),
+                         chunk.inputs.row(row), chunk.expected.row(row), error))
+      return true;
+
+    if (!error.empty())
+      throw std::runtime_error(filename + ":" + std::to_string(line_number) +
+                               ": " + error);
+  }
+
+  return false;
+}
+
+bool StreamingDataSource::readBinary(std::ifstream &inputs,
+                                     std::ifstream &expected,
+                                     Dataset &chunk, Size row) {
+  inputs.read((char *)chunk.inputs.row(row).data(),
+              input_size * sizeof(Scalar));
+  expected.read((char *)chunk.expected.row(row).data(),
+                output_size * sizeof(Scalar));
+
+  return !inputs.fail() && !expected.fail();
+}
+
+void StreamingDataSource::run() {
+  Size pass = 0;
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      changed.wait(lock, [&] { return quitting || passes != pass; });
+
+      if (quitting)
+        return;
+
+      pass = passes;
+    }
+
+    read();
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      reading = false;
+    }
+    changed.notify_all();
+  }
+}
+
+void StreamingDataSource::read() {
+  // chunks are resized while training runs
+  AllocationCheckPause pause;
+
+  std::ifstream inputs(filename, std::ios::in | std::ios::binary);
+  std::ifstream expected;
+
+  line_number = 0;
+
+  uint64_t remaining = 0;
+
+  if (binary) {
+    // the two blocks are read side by side through their own streams
+    expected.open(filename, std::ios::in | std::ios::binary);
+    inputs.seekg(header.inputs_offset);
+    expected.seekg(header.expected_offset);
+    remaining = header.samples;
+  } else {
+    // text files are parsed as text
+    inputs.close();
+    inputs.open(filename, std::ios::in);
+  }
+
+  bool more = true;
+
+  while (more) {
+    Dataset chunk(input_size, output_size);
+
+    {
+      // wait for room in the queue
+      std::unique_lock<std::mutex> lock(mutex);
+      changed.wait(lock,
+                   [this] { return stopping || ready.size() < prefetch; });
+
+      if (stopping)
+        return;
+
+      if (!spare.empty()) {
+        // the consumer may hand back a data set of some other shape
+        if (spare.back().inputs.cols() == input_size &&
+            spare.back().expected.cols() == output_size)
+          chunk = std::move(spare.back());
+        spare.pop_back();
+      }
+    }
+
+    // parse outside the lock, this is the part that overlaps training
+    chunk.resize(chunk_size);
+
+    Size count = 0;
+
+    try {
+      if (binary && header.dtype == DATASET_ENCODED) {
+        // widened straight from the mapping, one column at a time
+        count = std::min<uint64_t>(chunk_size, remaining);
+        decodeSamples(mapping, header, columns, header.samples - remaining,
+                      count, chunk, 0);
+        remaining -= count;
+        more = remaining > 0;
+      }
+
+      while (count < chunk_size && more) {
+        if (binary)
+          more = remaining > 0 && readBinary(inputs, expected, chunk, count);
+        else
+          more = readText(inputs, chunk, count);
+
+        if (!more)
+          break;
+
+        if (binary)
+          remaining--;
+
+        count++;
+      }
+    } catch (...) {
+      // handed to the consumer once it has trained on the good chunks
+      std::lock_guard<std::mutex> lock(mutex);
+      failure = std::current_exception();
+      more = false;
+    }
+
+    chunk.resize(count);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+
+      if (count > 0)
+        ready.push(std::move(chunk));
+
+      finished = !more;
+    }
+    changed.notify_all();
+  }
+}
@@ -0,0 +1,257 @@
+#ifndef DATASET_H
+
+#include "NeuralNetwork.h"
+#include "ThreadPool.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <vector>
+
+// Binary dataset files.
+//
+// A fixed size header, followed by the inputs of every sample as one
+// contiguous row-major block, and then the expected outputs as another. Both
+// blocks start on a 64 byte boundary, so a memory mapped file can be used in
+// place without any parsing. Values are stored in the machine's native byte
+// order.
+//
+// Encoded files (dtype DATASET_ENCODED) instead store every column (inputs,
+// then expected outputs) as its own block, in the smallest type that holds
+// all of its values exactly: uint8 (with a scale and offset), fp16 or fp32.
+// `inputs_offset` then points to a table of one ColumnEncoding per column.
+// readBinaryTrainingData keeps the input columns encoded in the mapping and
+// widens them a batch (or sample) at a time as training reads them; only the
+// expected outputs are decoded as the data set is loaded. Inputs that are
+// mostly zero are decoded into a sparse matrix instead.
+
+static const char DATASET_MAGIC[4] = {'N', 'N', 'D', 'S'};
+static const uint32_t DATASET_VERSION = 1;
+
+enum DatasetType : uint32_t {
+  DATASET_FLOAT32 = 1,
+  DATASET_ENCODED = 2
+};
+
+enum ColumnType : uint32_t {
+  COLUMN_FLOAT32 = 1,
+  COLUMN_FLOAT16 = 2,
+  // value = offset + scale * stored
+  COLUMN_UINT8 = 3
+};
+
+struct ColumnEncoding {
+  uint32_t type;
+  float scale;
+  float offset;
+  uint32_t reserved;
+  // byte offset of the column's block from the start of the file
+  uint64_t data_offset;
+};
+
+struct DatasetHeader {
+  char magic[4];
+  uint32_t version;
+  // type of every stored value
+  uint32_t dtype;
+  uint32_t input_size;
+  uint32_t output_size;
+  uint32_t reserved;
+  uint64_t samples;
+  // byte offsets of the blocks from the start of the file
+  uint64_t inputs_offset;
+  uint64_t expected_offset;
+};
+
+// read-only memory mapping of a whole file
+class MappedFile {
+public:
+  MappedFile();
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  // returns false if the file could not be opened or mapped
+  bool open(std::string filename);
+  void close();
+
+  const char *data() const;
+  size_t size() const;
+
+private:
+  const char *address;
+  size_t length;
+};
+
+// whether a file starts with the binary dataset magic
+bool isBinaryDataset(std::string filename);
+
+// write a data set in the binary format. with `encode`, each column is
+// stored in the smallest type that holds its values without loss.
+bool saveBinaryTrainingData(std::string filename, const Dataset &data,
+                            bool encode = false);
+
+// Writes a (float32) binary data set a chunk of samples at a time, so that data
+// sets larger than memory can be written. the number of samples has to be
+// known up front, since it sets where the expected outputs start.
+class BinaryDatasetWriter {
+public:
+  // returns false if the file could not be created
+  bool open(std::string filename, Size input_size, Size output_size,
+            uint64_t samples);
+
+  // append the samples of a chunk. returns false on a write error.
+  bool write(const Dataset &chunk);
+
+  // returns false if the file is missing any samples, or could not be written
+  bool close();
+
+private:
+  std::ofstream file;
+  DatasetHeader header;
+  uint64_t written;
+};
+
+// map a binary data set (keeping its inputs encoded, if encoded). returns no
+// samples if the file is not a binary data set, or does not fit the topology.
+Dataset readBinaryTrainingData(std::string filename, Topology topology);
+
+// the column encodings of an encoded data set, checked against the size of
+// the file. returns false if they do not describe a valid file.
+bool readColumnEncodings(const MappedFile &file, const DatasetHeader &header,
+                         std::vector<ColumnEncoding> &columns);
+
+// widen `rows` samples from `first` of an encoded data set into `data`,
+// starting at row `row`.
+void decodeSamples(const MappedFile &file, const DatasetHeader &header,
+                   const std::vector<ColumnEncoding> &columns, uint64_t first,
+                   Size rows, Dataset &data, Size row);
+
+// Split a data set into views for training and validation, holding out
+// `fraction` of the samples, picked pseudo-randomly from `seed`.
+void splitDataset(const Dataset &data, Scalar fraction, unsigned int seed,
+                  DatasetView &training, DatasetView &validation);
+
+// Fold `fold` of `folds` for cross validation: the data set is shuffled with
+// `seed` and cut into `folds` even parts, the fold's part is held out for
+// validation, and the rest is used for training. the same seed always gives
+// the same folds, so every fold is held out exactly once.
+void foldDataset(const Dataset &data, Size folds, Size fold,
+                 unsigned int seed, DatasetView &training,
+                 DatasetView &validation);
+
+// A data set that is read a chunk of samples at a time.
+class DataSource {
+public:
+  virtual ~DataSource() {}
+
+  // go back to the first sample
+  virtual void rewind() = 0;
+
+  // replace `chunk` with the next samples. returns false, leaving `chunk`
+  // empty, once every sample has been read. may throw std::runtime_error if
+  // the data is malformed.
+  virtual bool next(Dataset &chunk) = 0;
+};
+
+// Hands out an in-memory data set a chunk at a time (as copies), so that it
+// can go through the same stages as a streamed one.
+class DatasetSource : public DataSource {
+public:
+  DatasetSource(const Dataset &data, Size chunk_size = 4096);
+
+  void rewind() override;
+  bool next(Dataset &chunk) override;
+
+private:
+  const Dataset &data;
+  Size chunk_size;
+  Size position;
+};
+
+// Streams a training data file (text or binary) from disk.
+//
+// A background thread reads and parses up to `prefetch` chunks ahead of the
+// consumer, so reading chunk N + 1 overlaps training on chunk N. Chunks handed
+// back through next() are reused, and at most prefetch + 2 chunks exist at
+// once, so memory use does not depend on the size of the file. The reader
+// runs on the I/O lane of `pool` for as long as the source lives, and starts
+// a new pass on every rewind().
+class StreamingDataSource : public DataSource {
+public:
+  StreamingDataSource(std::string filename, Topology topology,
+                      ThreadPool &pool, Size chunk_size = 4096,
+                      Size prefetch = 2);
+  ~StreamingDataSource();
+
+  StreamingDataSource(const StreamingDataSource &) = delete;
+  StreamingDataSource &operator=(const StreamingDataSource &) = delete;
+
+  // whether the file could be opened, and (if binary) fits the topology
+  bool isOpen() const;
+
+  void rewind() override;
+  bool next(Dataset &chunk) override;
+
+private:
+  // body of the reader task, one read() per pass
+  void run();
+  // read the file once, until its end or until stopped
+  void read();
+
+  // read one sample, returns false at the end of the data
+  bool readText(std::ifstream &file, Dataset &chunk, Size row);
+  bool readBinary(std::ifstream &inputs, std::ifstream &expected,
+                  Dataset &chunk, Size row);
+
+  void start();
+  void stop();
+
+  std::string filename;
+  Size input_size, output_size;
+  Size chunk_size, prefetch;
+
+  bool binary, open;
+  DatasetHeader header;
+
+  // encoded files are mapped and decoded a chunk at a time
+  MappedFile mapping;
+  std::vector<ColumnEncoding> columns;
+
+  // current line of a text file, for error messages
+  std::string line;
+  size_t line_number;
+
+  TaskGroup reader;
+  std::mutex mutex;
+  std::condition_variable changed;
+
+  // parsed chunks waiting to be trained on
+  std::queue<Dataset> ready;
+  // chunks given back by the consumer, refilled by the reader
+  std::vector<Dataset> spare;
+
+  // the reader has reached the end of the file
+  bool finished;
+  // the reader has been asked to stop early
+  bool stopping;
+  // passes started, and whether the reader is in one
+  Size passes;
+  bool reading;
+  // the reader task has been asked to exit
+  bool quitting;
+  // what stopped the reader, if the file was malformed
+  std::exception_ptr failure;
+  // nothing has been taken since the reader started
+  bool fresh;
+};
+
+#endif
+
+#define DATASET_H
@@ -1,6 +1,16 @@
 #include "NetworkReflection.h"
+#include "Dataset.h"
+#include "ThreadPool.h"
 
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
 
 bool saveWeights(std::string filename, NetworkWeights &weights) {
   std::ofstream file(filename, std::ios::out | std::ios::binary);
@@ -16,13 +26,13 @@ bool saveWeights(std::string filename, NetworkWeights &weights) {
   // NOTE: no static type sizes, system independent.
 
   for (Size i = 0; i < weights.size(); i++) {
-    Matrix *weightMatrix = weights[i];
-    long rows = weightMatrix->rows();
-    long cols = weightMatrix->cols();
+    MatrixMap &weightMatrix = weights[i];
+    long rows = weightMatrix.rows();
+    long cols = weightMatrix.cols();
 
     for (long row = 0; row < rows; row++) {
       for (long col = 0; col < cols; col++) {
-        Scalar weight = (*weightMatrix)(row, col);
+        Scalar weight = weightMatrix(row, col);
         file.write((char *)&weight, sizeof(Scalar));
       }
     }
@@ -33,41 +43,36 @@ bool saveWeights(std::string filename, NetworkWeights &weights) {
   return true;
 };
 
-NetworkWeights &readWeights(std::string filename, Topology &topology){
+bool readWeights(std::string filename, NetworkWeights &weights) {
   std::ifstream file(filename, std::ios::in | std::ios::binary);
 
-  NetworkWeights *weights = new NetworkWeights();
-
   if (!file.is_open()) {
     // opening error
-    // HACK: hack?
-    return *weights;
+    return false;
   }
 
-  // Now we basically do the same thing, but in reverse.
-
-  for (Size layer_index = 1; layer_index < topology.size(); layer_index++) {
-    Size rows, cols;
-
-    rows = topology[layer_index - 1] + 1;
-    cols = topology[layer_index];
+  // Now we basically do the same thing, but in reverse, straight into the
+  // network's own weight matrices.
 
-    Matrix *weightMatrix = new Matrix(rows, cols);
+  for (Size i = 0; i < weights.size(); i++) {
+    MatrixMap &weightMatrix = weights[i];
+    long rows = weightMatrix.rows();
+    long cols = weightMatrix.cols();
 
-    for (Size row = 0; row < rows; row++) {
-      for (Size col = 0; col < cols; col++) {
+    for (long row = 0; row < rows; row++) {
+      for (long col = 0; col < cols; col++) {
         Scalar weight;
         file.read((char *)&weight, sizeof(weight));
-        (*weightMatrix)(row, col) = weight;
+        weightMatrix(row, col) = weight;
       }
     }
-
-    weights->push_back(weightMatrix);
   }
 
+  bool complete = !file.fail();
+
   file.close();
 
-  return *weights;
+  return complete;
 };
 
 Topology &readTopology(std::string filename) {
@@ -90,47 +95,498 @@ Topology &readTopology(std::string filename) {
   return *topology;
 };
 
-TrainingData readTrainingData(std::string filename, Topology topology) {
-  std::ifstream file (filename, std::ios::in);
+static bool isSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' ||
+         c == '\f';
+}
+
+// Parse a short decimal like "13.0" or "-0.25" exactly, without going through
+// from_chars: if both the digits (as an integer) and the power of ten are
+// exactly representable as floats, one division rounds correctly. returns
+// nullptr for anything else (exponents, long mantissas, ...).
+static const char *parseShortDecimal(const char *position, const char *end,
+                                     float &value) {
+  static const float POWERS_OF_TEN[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f,
+                                        1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+
+  bool negative = position < end && *position == '-';
+  if (negative)
+    position++;
+
+  uint32_t mantissa = 0;
+  int digits = 0, decimals = 0;
+  bool point = false;
+
+  for (; position < end; position++) {
+    char c = *position;
+
+    if (c >= '0' && c <= '9') {
+      // more digits than a float mantissa can hold
+      if (++digits > 7)
+        return nullptr;
+      mantissa = mantissa * 10 + (c - '0');
+      decimals += point;
+    } else if (c == '.' && !point) {
+      point = true;
+    } else if (isSpace(c)) {
+      break;
+    } else {
+      return nullptr;
+    }
+  }
 
-  TrainingData *trainingData = new TrainingData();
+  if (digits == 0)
+    return nullptr;
 
-  if (!file.is_open()) {
-    // FIX: maybe an exception?
-   
-    // opening error
-    return *trainingData;
+  value = (float)mantissa / POWERS_OF_TEN[decimals];
+
+  if (negative)
+    value = -value;
+
+  return position;
+}
+
+// parse the number at the start of [position, end), returns where it ends, or
+// nullptr if there is no number there
+static const char *parseNumber(const char *position, const char *end,
+                               Scalar &value) {
+  const char *parsed = parseShortDecimal(position, end, value);
+
+  if (parsed != nullptr)
+    return parsed;
+
+  // from_chars never looks at the locale, and does not allocate
+  std::from_chars_result result = std::from_chars(position, end, value);
+
+  return result.ec == std::errc() ? result.ptr : nullptr;
+}
+
+bool parseTrainingRow(const char *begin, const char *end,
+                      Eigen::Ref<Vector> input, Eigen::Ref<Vector> expected,
+                      std::string &error) {
+  Size input_size = input.size();
+  Size expected_size = expected.size();
+
+  Size count = 0;
+
+  const char *position = begin;
+
+  while (true) {
+    while (position < end && isSpace(*position))
+      position++;
+
+    if (position == end)
+      break;
+
+    Scalar value;
+
+    const char *parsed = parseNumber(position, end, value);
+
+    if (parsed == nullptr || (parsed < end && !isSpace(*parsed))) {
+      const char *token_end = position;
+      while (token_end < end && !isSpace(*token_end))
+        token_end++;
+
+      error = "invalid number '" + std::string(position, token_end) + "'";
+      return false;
+    }
+
+    if (count < input_size)
+      input(count) = value;
+    else if (count < input_size + expected_size)
+      expected(count - input_size) = value;
+
+    count++;
+    position = parsed;
   }
 
-  Size input_size, expected_size;
+  // a blank line
+  if (count == 0)
+    return false;
 
-  input_size = topology[0];
-  expected_size = topology.back();
+  if (count != input_size + expected_size) {
+    error = "expected " + std::to_string(input_size + expected_size) +
+            " values, found " + std::to_string(count);
+    return false;
+  }
 
-  Scalar n;
+  return true;
+}
+
+// one newline aligned part of a text file
+struct ParsedPart {
+  const char *begin, *end;
+  // lines in the part, and the row of the data set its first line goes to
+  size_t lines = 0;
+  size_t first_row = 0;
+  // rows actually parsed (blank lines take none)
+  size_t rows = 0;
+  // the first bad line (counted from the start of the part), if any
+  bool failed = false;
+  size_t error_line = 0;
+  std::string error;
+};
 
-  while (!file.eof()) {
-    Vector input (input_size);
-    Vector expected (expected_size);
+// fills row `row` of the data set from the line [begin, end). returns false
+// for a line to skip, with `error` set if the line is malformed.
+typedef std::function<bool(const char *begin, const char *end, Size row,
+                           std::string &error)>
+    LineParser;
 
-    for (Size i = 0; i < input_size; i++) {
-      file >> n;
-      input(i) = n;
+static size_t countLines(const char *begin, const char *end) {
+  size_t lines = 0;
+
+  for (const char *line = begin; line < end; lines++) {
+    const char *line_end = (const char *)std::memchr(line, '\n', end - line);
+    line = line_end ? line_end + 1 : end;
+  }
+
+  return lines;
+}
+
+// parse a part straight into its rows of the data set
+static void parsePart(ParsedPart &part, size_t skip_lines,
+                      const LineParser &parse) {
+  size_t line_index = 0;
+
+  for (const char *line = part.begin; line < part.end; line_index++) {
+    const char *line_end =
+        (const char *)std::memchr(line, '\n', part.end - line);
+
+    if (line_end == nullptr)
+      line_end = part.end;
+
+    size_t row = part.first_row + part.rows;
+    std::string error;
+
+    if (part.first_row + line_index < skip_lines) {
+      // a header
+    } else if (parse(line, line_end, row, error)) {
+      part.rows++;
+    } else if (!error.empty()) {
+      part.failed = true;
+      part.error_line = line_index;
+      part.error = error;
+      return;
     }
 
-    for (Size i = 0; i < expected_size; i++) {
-      file >> n;
-      expected(i) = n;
+    line = line_end + 1;
+  }
+}
+
+// Parse a text file with one sample per line into `data` (which sets the
+// shape of the rows), in parallel: the file is mapped and split at newlines
+// into a few parts per thread, rows are sized for one sample per line, and
+// each part is parsed straight into its own rows. the first `skip_lines` lines
+// are skipped. returns false if the file could not be opened.
+static bool parseLines(std::string filename, Dataset &data, ThreadPool *pool,
+                       size_t skip_lines, const LineParser &parse) {
+  MappedFile file;
+
+  if (!file.open(filename)) {
+    // opening error (or an empty file)
+    return false;
+  }
+
+  const char *begin = file.data();
+  const char *end = begin + file.size();
+
+  // a few parts per thread, so that uneven lines still balance out, but never
+  // parts so small that splitting them costs more than parsing them
+  const size_t MIN_PART_BYTES = 1 << 20;
+
+  size_t parts = pool ? pool->size() * 4 : 1;
+  parts = std::max<size_t>(1, std::min(parts, file.size() / MIN_PART_BYTES));
+
+  std::vector<ParsedPart> parsed(parts);
+
+  // split at the first newline after each even division of the file
+  for (size_t part = 0; part < parts; part++) {
+    const char *bound = begin + file.size() * part / parts;
+
+    if (part > 0) {
+      bound = std::max(bound, parsed[part - 1].begin);
+
+      const char *newline =
+          (const char *)std::memchr(bound, '\n', end - bound);
+      bound = newline ? newline + 1 : end;
+
+      parsed[part - 1].end = bound;
     }
 
-    TrainingDatum datum = {input, expected};
+    parsed[part].begin = bound;
+    parsed[part].end = end;
+  }
+
+  // size the data set for one row per line, then parse every part in place
+  parallel_for(pool, 0, parts, [&](Size part) {
+    parsed[part].lines = countLines(parsed[part].begin, parsed[part].end);
+  });
+
+  size_t lines = 0;
+
+  for (ParsedPart &part : parsed) {
+    part.first_row = lines;
+    lines += part.lines;
+  }
+
+  data.resize(lines);
+
+  parallel_for(pool, 0, parts, [&](Size part) {
+    parsePart(parsed[part], skip_lines, parse);
+  });
+
+  // close the gaps left by skipped lines
+  size_t rows = 0;
+
+  for (ParsedPart &part : parsed) {
+    if (part.failed)
+      throw std::runtime_error(filename + ":" +
+                               std::to_string(part.first_row +
+                                              part.error_line + 1) +
+                               ": " + part.error);
 
-    trainingData->push_back(datum);
+    if (rows != part.first_row && part.rows > 0) {
+      data.inputs.middleRows(rows, part.rows) =
+          data.inputs.middleRows(part.first_row, part.rows).eval();
+      data.expected.middleRows(rows, part.rows) =
+          data.expected.middleRows(part.first_row, part.rows).eval();
+
+      if (data.labelled())
+        std::copy(data.labels.begin() + part.first_row,
+                  data.labels.begin() + part.first_row + part.rows,
+                  data.labels.begin() + rows);
+    }
+
+    rows += part.rows;
   }
 
-  return *trainingData;
+  data.resize(rows);
+
+  return true;
+}
+
+Dataset readTrainingData(std::string filename, Topology topology,
+                         ThreadPool *pool) {
+  if (isBinaryDataset(filename))
+    return readBinaryTrainingData(filename, topology);
+
+  Dataset trainingData(topology.front(), topology.back());
+
+  if (!parseLines(filename, trainingData, pool, 0,
+                  [&](const char *begin, const char *end, Size row,
+                      std::string &error) {
+                    return parseTrainingRow(begin, end,
+                                            trainingData.inputs.row(row),
+                                            trainingData.expected.row(row),
+                                            error);
+                  }))
+    return trainingData;
+
+  // classification data keeps just the class of each sample, and mostly zero
+  // inputs only their non-zero values
+  trainingData.useLabels();
+  trainingData.useSparseInputs();
+
+  return trainingData;
 };
 
+// "a-b" or "a", as a list of columns. false for a reversed range.
+static bool readColumnRange(const std::string &range,
+                            std::vector<Size> &columns) {
+  size_t dash = range.find('-');
+
+  try {
+    Size first = std::stoul(range.substr(0, dash));
+    Size last =
+        dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+
+    if (last < first)
+      return false;
+
+    for (Size column = first; column <= last; column++)
+      columns.push_back(column);
+  } catch (const std::exception &) {
+    return false;
+  }
+
+  return true;
+}
+
+IngestSpec readIngestSpec(std::string filename) {
+  std::ifstream file(filename, std::ios::in);
+
+  IngestSpec spec;
+  spec.separator = ',';
+  spec.header_lines = 0;
+  spec.label_column = -1;
+
+  if (!file.is_open())
+    throw std::runtime_error(filename + ": could not be opened");
+
+  std::string line;
+  size_t line_number = 0;
+
+  while (std::getline(file, line)) {
+    line_number++;
+
+    std::istringstream words(line);
+    std::string key, word;
+
+    // blank lines and comments
+    if (!(words >> key) || key[0] == '#')
+      continue;
+
+    std::string where = filename + ":" + std::to_string(line_number) + ": ";
+
+    if (key == "features") {
+      while (words >> word)
+        if (!readColumnRange(word, spec.feature_columns))
+          throw std::runtime_error(where + "invalid column '" + word + "'");
+    } else if (key == "label") {
+      if (!(words >> spec.label_column))
+        throw std::runtime_error(where + "expected a label column");
+
+      while (words >> word)
+        spec.vocabulary.push_back(word);
+    } else if (key == "separator") {
+      if (!(words >> word) || (word != "\\t" && word.size() != 1))
+        throw std::runtime_error(where + "expected a single character");
+
+      // a tab can not be written as itself, the spec is split on whitespace
+      spec.separator = word == "\\t" ? '\t' : word[0];
+    } else if (key == "header") {
+      if (!(words >> spec.header_lines))
+        throw std::runtime_error(where + "expected a number of lines");
+    } else {
+      throw std::runtime_error(where + "unknown setting '" + key + "'");
+    }
+  }
+
+  if (spec.feature_columns.empty() || spec.label_column < 0 ||
+      spec.vocabulary.empty())
+    throw std::runtime_error(filename +
+                             ": needs a features line and a label line");
+
+  // every column goes to one place only, or some input is never written
+  std::vector<Size> sorted = spec.feature_columns;
+  std::sort(sorted.begin(), sorted.end());
+
+  auto repeated = std::adjacent_find(sorted.begin(), sorted.end());
+
+  if (repeated != sorted.end())
+    throw std::runtime_error(filename + ": feature column " +
+                             std::to_string(*repeated) + " is listed twice");
+
+  if (std::binary_search(sorted.begin(), sorted.end(),
+                         (Size)spec.label_column))
+    throw std::runtime_error(filename + ": the label column " +
+                             std::to_string(spec.label_column) +
+                             " is also a feature column");
+
+  return spec;
+}
+
+Dataset ingestCsv(std::string filename, const IngestSpec &spec,
+                  ThreadPool *pool) {
+  Size features = spec.feature_columns.size();
+  Size classes = spec.vocabulary.size();
+
+  // where each column of a row goes: a feature index, the label, or nowhere
+  const int IGNORED = -1, LABEL = -2;
+
+  Size columns = std::max<Size>(
+      spec.label_column + 1, *std::max_element(spec.feature_columns.begin(),
+                                              spec.feature_columns.end()) +
+                                 1);
+
+  std::vector<int> destination(columns, IGNORED);
+
+  for (Size feature = 0; feature < features; feature++)
+    destination[spec.feature_columns[feature]] = feature;
+
+  destination[spec.label_column] = LABEL;
+
+  std::unordered_map<std::string, Size> class_index;
+
+  for (Size label = 0; label < classes; label++)
+    class_index[spec.vocabulary[label]] = label;
+
+  Dataset data(features, 0);
+  data.classes = classes;
+
+  auto trim = [](const char *&begin, const char *&end) {
+    while (begin < end && isSpace(*begin))
+      begin++;
+    while (end > begin && isSpace(*(end - 1)))
+      end--;
+  };
+
+  bool opened = parseLines(
+      filename, data, pool, spec.header_lines,
+      [&](const char *begin, const char *end, Size row, std::string &error) {
+        trim(begin, end);
+
+        // a blank line
+        if (begin == end)
+          return false;
+
+        Size column = 0;
+        const char *field = begin;
+
+        for (; field <= end && column < columns; column++) {
+          const char *field_end = (const char *)std::memchr(
+              field, spec.separator, end - field);
+
+          if (field_end == nullptr)
+            field_end = end;
+
+          const char *value_begin = field, *value_end = field_end;
+          trim(value_begin, value_end);
+
+          if (destination[column] == LABEL) {
+            auto label =
+                class_index.find(std::string(value_begin, value_end));
+
+            if (label == class_index.end()) {
+              error = "unknown label '" + std::string(value_begin, value_end) +
+                      "'";
+              return false;
+            }
+
+            data.labels[row] = label->second;
+          } else if (destination[column] != IGNORED) {
+            Scalar value;
+
+            if (parseNumber(value_begin, value_end, value) != value_end ||
+                value_begin == value_end) {
+              error = "invalid number '" +
+                      std::string(value_begin, value_end) + "' in column " +
+                      std::to_string(column);
+              return false;
+            }
+
+            data.inputs(row, destination[column]) = value;
+          }
+
+          field = field_end + 1;
+        }
+
+        if (column < columns) {
+          error = "expected at least " + std::to_string(columns) +
+                  " columns, found " + std::to_string(column);
+          return false;
+        }
+
+        return true;
+      });
+
+  if (!opened)
+    throw std::runtime_error(filename + ": could not be opened");
+
+  return data;
+}
+
 Configuration readConfiguration(std::string filename) {
   std::ifstream file (filename, std::ios::in);
 
@@ -185,5 +641,67 @@ Configuration readConfiguration(std::string filename) {
   else
     config->output_activation = NONE;
 
+  // optional `key value` settings may follow the positional hyperparameters
+
+  config->batch_size = 1;
+  config->threads = 0;
+  config->mode = SYNCHRONOUS;
+  config->shuffle = SHUFFLE_NONE;
+  config->shuffle_block = 4096;
+  config->seed = 0;
+  config->sampling = SAMPLING_UNIFORM;
+  config->sample_fraction = 1.0;
+  config->transforms = {false, 0.0, false, 0.0, 0.0, 2};
+
+  while (file >> str) {
+    if (str == "batch_size")
+      file >> config->batch_size;
+    else if (str == "threads")
+      file >> config->threads;
+    else if (str == "mode") {
+      file >> str;
+      config->mode = str == "hogwild" ? HOGWILD : SYNCHRONOUS;
+    } else if (str == "shuffle") {
+      file >> str;
+      config->shuffle = str == "full"    ? SHUFFLE_FULL
+                        : str == "block" ? SHUFFLE_BLOCK
+                                         : SHUFFLE_NONE;
+    } else if (str == "shuffle_block")
+      file >> config->shuffle_block;
+    else if (str == "seed")
+      file >> config->seed;
+    else if (str == "sampling") {
+      file >> str;
+      config->sampling = str == "loss" ? SAMPLING_LOSS : SAMPLING_UNIFORM;
+    } else if (str == "sample_fraction")
+      file >> config->sample_fraction;
+    else if (str == "standardize")
+      config->transforms.standardize = true;
+    else if (str == "noise")
+      file >> config->transforms.noise;
+    else if (str == "clip") {
+      config->transforms.clip = true;
+      file >> config->transforms.clip_min >> config->transforms.clip_max;
+    } else if (str == "producers")
+      file >> config->transforms.producers;
+    else
+      throw std::runtime_error(filename + ": unknown setting '" + str + "'");
+  }
+
+  if (config->batch_size < 1)
+    config->batch_size = 1;
+
+  if (config->threads < 1)
+    config->threads = 0;
+
+  if (config->shuffle_block < 1)
+    config->shuffle_block = 1;
+
+  if (!(config->sample_fraction > 0))
+    config->sample_fraction = 1.0;
+
+  if (config->transforms.producers < 1)
+    config->transforms.producers = 1;
+
   return *config;
 };
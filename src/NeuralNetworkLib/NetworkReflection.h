@@ -2,6 +2,9 @@
 
 #include "NeuralNetwork.h"
 
+#include <string>
+#include <vector>
+
 // TODO: determine structure of weights written to disk
 // - Need to write topology to file
 // - Need to write weights to file (efficiently would be nice)
@@ -14,15 +17,63 @@
 
 bool saveWeights(std::string filename, NetworkWeights &weights);
 
-// returns new instance of neural network (no effort required!);
-NetworkWeights &readWeights(std::string filename, Topology &topology);
+// reads weights into an existing network's weights (which fixes their shape).
+// returns false if the file could not be opened or was too short.
+bool readWeights(std::string filename, NetworkWeights &weights);
 
 Topology &readTopology(std::string filename);
 
-TrainingData readTrainingData(std::string filename, Topology topology);
+// reads either a text data set, or a binary one (see Dataset.h).
+//
+// text data sets have one sample per line: the inputs followed by the expected
+// outputs, separated by whitespace. blank lines are skipped. the file is split
+// at line boundaries and parsed in parallel on the pool, if one is given.
+// throws std::runtime_error, naming the line, if a line is malformed.
+// one-hot expected outputs are kept as labels, and mostly zero inputs in
+// sparse form (see Dataset::useLabels and Dataset::useSparseInputs).
+Dataset readTrainingData(std::string filename, Topology topology,
+                         ThreadPool *pool = nullptr);
+
+// parse one line of a text data set into one sample's `input` and `expected`
+// rows. returns false for a blank line (leaving `error` empty), or with
+// `error` set if the line is malformed.
+bool parseTrainingRow(const char *begin, const char *end,
+                      Eigen::Ref<Vector> input, Eigen::Ref<Vector> expected,
+                      std::string &error);
 
+// read config.txt. throws std::runtime_error on a setting it does not know.
 Configuration readConfiguration(std::string filename);
 
+// How to read a raw CSV file into a classification data set, read from a spec
+// file such as
+//
+//   # columns count from 0
+//   label 0 A B C D
+//   features 1-16
+//   separator ,
+//   header 0
+//
+// `label` names the label column, followed by its vocabulary (in class
+// order). `features` lists the input columns, as single columns or ranges,
+// in input order. other columns are ignored.
+struct IngestSpec {
+  std::vector<Size> feature_columns;
+  int label_column;
+  std::vector<std::string> vocabulary;
+  char separator;
+  // lines to skip at the top of the file
+  Size header_lines;
+};
+
+// throws std::runtime_error, naming the line, if the spec is malformed
+IngestSpec readIngestSpec(std::string filename);
+
+// read a CSV file into a labelled data set, in parallel on the pool (if one
+// is given). throws std::runtime_error, naming the line, if a line is
+// malformed or has a label outside the vocabulary.
+Dataset ingestCsv(std::string filename, const IngestSpec &spec,
+                  ThreadPool *pool = nullptr);
+
 #endif
 
 #define NETWORKREFLECTION_H
@@ -1,19 +1,156 @@
 #include "NeuralNetwork.h"
+#include "Dataset.h"
+#include "ThreadPool.h"
 #include "maths.h"
 
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
 #include <functional>
 #include <iostream>
 #include <mutex>
+#include <numeric>
 #include <queue>
+#include <random>
 #include <stdexcept>
 #include <thread>
 
+// arena blocks are aligned to a cache line, which also satisfies Eigen's
+// largest vector alignment.
+static const Size ARENA_ALIGNMENT = 64;
+
+// activations of one inference batch should fit in about this much cache
+static const Size INFERENCE_CACHE_BYTES = 256 * 1024;
+
+NetworkArena::NetworkArena() : block(nullptr), capacity(0), used(0) {}
+
+NetworkArena::NetworkArena(NetworkArena &&other)
+    : block(other.block), capacity(other.capacity), used(other.used) {
+  other.block = nullptr;
+  other.capacity = 0;
+  other.used = 0;
+}
+
+NetworkArena::~NetworkArena() { std::free(block); }
+
+void NetworkArena::allocate(Size count) {
+  std::free(block);
+
+  capacity = padded(count);
+  used = 0;
+
+  // aligned_alloc wants a non-zero multiple of the alignment
+  block = (Scalar *)std::aligned_alloc(
+      ARENA_ALIGNMENT,
+      std::max<size_t>(capacity * sizeof(Scalar), ARENA_ALIGNMENT));
+  if (block == nullptr)
+    throw std::bad_alloc();
+
+  std::memset(block, 0, capacity * sizeof(Scalar));
+}
+
+Scalar *NetworkArena::take(Size count) {
+  if (used + padded(count) > capacity)
+    throw std::length_error("Arena is too small");
+
+  Scalar *buffer = block + used;
+  used += padded(count);
+  return buffer;
+}
+
+void NetworkArena::copyFrom(const NetworkArena &other) {
+  if (capacity != other.capacity)
+    throw std::invalid_argument("Arena layouts do not match");
+
+  std::memcpy(block, other.block, capacity * sizeof(Scalar));
+}
+
+Size NetworkArena::padded(Size count) {
+  Size per_line = ARENA_ALIGNMENT / sizeof(Scalar);
+  return (count + per_line - 1) / per_line * per_line;
+}
+
+// Debug builds define EIGEN_RUNTIME_NO_MALLOC, which makes Eigen assert on any
+// heap allocation made while a NoMallocScope is alive. the per-sample training
+// loops run inside one, which checks they stay allocation-free. (the batched
+// paths are left out, Eigen's GEMM may allocate blocking space for large
+// products; the nomalloc_check program runs them inside one on a network small
+// enough for Eigen to keep that space on the stack.) Eigen's flag is global,
+// so scopes are counted: networks trained side by side share one, until the
+// last of them leaves it, and the check is off while any AllocationCheckPause
+// is alive.
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+static std::mutex allocation_check_mutex;
+static int no_malloc_depth = 0, allocation_check_pauses = 0;
+
+static void updateAllocationCheck() {
+  Eigen::internal::set_is_malloc_allowed(no_malloc_depth == 0 ||
+                                         allocation_check_pauses > 0);
+}
+#endif
+
+NoMallocScope::NoMallocScope() {
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+  std::lock_guard<std::mutex> lock(allocation_check_mutex);
+  no_malloc_depth++;
+  updateAllocationCheck();
+#endif
+}
+
+NoMallocScope::~NoMallocScope() {
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+  std::lock_guard<std::mutex> lock(allocation_check_mutex);
+  no_malloc_depth--;
+  updateAllocationCheck();
+#endif
+}
+
+AllocationCheckPause::AllocationCheckPause() {
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+  std::lock_guard<std::mutex> lock(allocation_check_mutex);
+  allocation_check_pauses++;
+  updateAllocationCheck();
+#endif
+}
+
+AllocationCheckPause::~AllocationCheckPause() {
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+  std::lock_guard<std::mutex> lock(allocation_check_mutex);
+  allocation_check_pauses--;
+  updateAllocationCheck();
+#endif
+}
+
+// sum the gradients of all workspaces into the first one with a pairwise tree.
+// the pairing only depends on the number of workspaces, so the result is
+// bit-identical for a given thread count.
+static void reduceGradients(std::vector<BatchWorkspace> &workspaces,
+                            ThreadPool *pool, Size first_layer) {
+  for (Size stride = 1; stride < workspaces.size(); stride *= 2) {
+    Size pairs = (workspaces.size() + stride - 1) / (2 * stride);
+
+    parallel_for(pool, 0, pairs, [&workspaces, stride, first_layer](Size pair) {
+      Size target = pair * stride * 2;
+
+      NetworkWeights &sum = workspaces[target].gradient;
+      NetworkWeights &other = workspaces[target + stride].gradient;
+
+      for (Size layer_index = first_layer; layer_index < sum.size();
+           layer_index++)
+        sum[layer_index] += other[layer_index];
+    });
+  }
+}
+
 NeuralNetwork::NeuralNetwork(Configuration c, Topology topology) {
   // Now we must initialise the network givin a topology;
   this->config = c;
 
   this->topology = topology; // for later reference.
+  this->pool = nullptr;
 
   initialiseVectors();
   // initialise weights
@@ -21,221 +158,1194 @@ NeuralNetwork::NeuralNetwork(Configuration c, Topology topology) {
 }
 
 NeuralNetwork::NeuralNetwork(Configuration c, Topology topology,
-                             NetworkWeights weights) {
+                             NetworkWeights &weights) {
   // Now we must initialise the network givin a topology;
 
   this->config = c;
 
   this->topology = topology; // for later reference.
-  this->weights = weights;
+  this->pool = nullptr;
 
   initialiseVectors();
-  // initialise weights
+
+  // copy the given weights into our own arena
+  for (Size layer_index = 0; layer_index < weights.size(); layer_index++)
+    this->weights[layer_index] = weights[layer_index];
+}
+
+NeuralNetwork::NeuralNetwork(const NeuralNetwork &other) {
+  this->config = other.config;
+  this->topology = other.topology;
+  this->pool = other.pool;
+
+  // same topology means same layout, so the arena can be copied wholesale
+  initialiseVectors();
+  arena.copyFrom(other.arena);
+}
+
+void NeuralNetwork::useThreadPool(ThreadPool *pool) { this->pool = pool; }
+
+Size NeuralNetwork::layerSize(Size layer_index) const {
+  // for all layers but the output, we want to have an extra neuron value to
+  // serve as the bias.
+  return layer_index < topology.size() - 1 ? topology[layer_index] + 1
+                                           : topology[layer_index];
+}
+
+Size NeuralNetwork::weightsSize() const {
+  Size size = 0;
+
+  for (Size layer_index = 1; layer_index < topology.size(); layer_index++)
+    size += NetworkArena::padded(layerSize(layer_index - 1) *
+                                 topology[layer_index]);
+
+  return size;
+}
+
+Size NeuralNetwork::workspaceSize() const {
+  Size size = 0;
+
+  for (Size layer_index = 0; layer_index < topology.size(); layer_index++)
+    size += NetworkArena::padded(layerSize(layer_index)) *
+            (layer_index != 0 ? 3 : 2);
+
+  return size;
 }
 
 void NeuralNetwork::initialiseVectors() {
+  arena.allocate(weightsSize() + workspaceSize());
+
+  weights.clear();
+
+  for (Size layer_index = 1; layer_index < topology.size(); layer_index++) {
+    // no bias neuron on the receiving side
+    Size n = layerSize(layer_index - 1);
+    Size m = topology[layer_index];
+
+    weights.push_back(MatrixMap(arena.take(n * m), n, m));
+  }
+
+  layoutWorkspace(workspace, arena);
+}
+
+void NeuralNetwork::layoutWorkspace(Workspace &workspace,
+                                    NetworkArena &arena) const {
+  workspace.neurons.clear();
+  workspace.preActivation.clear();
+  workspace.error.clear();
+
   for (Size layer_index = 0; layer_index < topology.size(); layer_index++) {
-    // for all layers but the output, we want to have an extra neuron value to
-    // serve as the bias.
-    Size layer_size = layer_index < topology.size() - 1
-                          ? topology[layer_index] + 1
-                          : topology[layer_index];
-
-    neurons.push_back(new Vector(layer_size));
-    preActivation.push_back(new Vector(layer_size));
+    Size layer_size = layerSize(layer_index);
+
+    workspace.neurons.push_back(VectorMap(arena.take(layer_size), layer_size));
+    workspace.preActivation.push_back(
+        VectorMap(arena.take(layer_size), layer_size));
     if (layer_index != 0)
-      error.push_back(new Vector(layer_size));
+      workspace.error.push_back(VectorMap(arena.take(layer_size), layer_size));
 
     // Bias coefficient is 1 always!!!
     if (layer_index != topology.size() - 1) {
-      neurons.back()->coeffRef(layer_size - 1) = 1.0;
-      preActivation.back()->coeffRef(layer_size - 1) = 1.0;
+      workspace.neurons.back().coeffRef(layer_size - 1) = 1.0;
+      workspace.preActivation.back().coeffRef(layer_size - 1) = 1.0;
     }
   }
 }
 
-void NeuralNetwork::randomWeights() {
-  for (Size layer_index = 1; layer_index < neurons.size(); layer_index++) {
-    Size n, m;
-    n = neurons[layer_index - 1]->size();
-    m = neurons[layer_index]->size();
-    if (layer_index < neurons.size() - 1)
-      m--; // remove bias neuron from next layer
+void NeuralNetwork::initialiseWorkspace(Workspace &workspace) const {
+  workspace.arena.allocate(workspaceSize());
+  layoutWorkspace(workspace, workspace.arena);
+}
+
+bool NeuralNetwork::fits(const Workspace &workspace) const {
+  if (workspace.neurons.size() != topology.size())
+    return false;
+
+  for (Size layer_index = 0; layer_index < topology.size(); layer_index++)
+    if (workspace.neurons[layer_index].size() != layerSize(layer_index))
+      return false;
 
-    weights.push_back(new Matrix(n, m));
+  return true;
+}
 
+void NeuralNetwork::randomWeights() {
+  for (Size layer_index = 0; layer_index < weights.size(); layer_index++) {
     // set eigien matrix coefficients to random values
-    weights.back()->setRandom(n, m);
+    weights[layer_index].setRandom();
   }
 }
 
-Vector NeuralNetwork::generate(Vector input) {
+const VectorMap &NeuralNetwork::generate(const VectorView &input) {
+  return generate(workspace, input);
+}
+
+const VectorMap &
+NeuralNetwork::generateConcurrent(const VectorView &input) const {
+  // one workspace per thread, re-laid out whenever the thread moves on to a
+  // network of another shape
+  static thread_local Workspace local;
+
+  if (!fits(local))
+    initialiseWorkspace(local);
+
+  return generate(local, input);
+}
+
+const VectorMap &NeuralNetwork::generate(Workspace &workspace,
+                                         const VectorView &input) const {
 
   // set input layer to input (excluding bias)
 
-  neurons.front()->block(0, 0, 1, input.size()) = input;
+  workspace.neurons.front().block(0, 0, 1, input.size()) = input;
 
-  for (Size layer_index = 1; layer_index < neurons.size(); layer_index++) {
+  generateLayers(workspace, 1);
 
-    Size num_to_update = neurons[layer_index]->size() - 1;
+  // return output layer
+  return workspace.neurons.back();
+}
 
-    if (layer_index == neurons.size() - 1)
-      num_to_update++;
+void NeuralNetwork::generateSparse(Workspace &workspace,
+                                   const SparseRowsMap &inputs,
+                                   Size sample) const {
+  // the first layer only reads the weight rows of the non-zero inputs, plus
+  // the bias row
+  const MatrixMap &first_weights = weights.front();
+  Size num_to_update = first_weights.cols();
 
-    // calculate preActivation for this layer (excluding bias)
-    preActivation[layer_index]->block(0, 0, 1, num_to_update) =
-        (*neurons[layer_index - 1]) * (*weights[layer_index - 1]);
+  auto preActivation = workspace.preActivation[1].head(num_to_update);
 
-    ActivationFunction activation = layer_index < neurons.size() - 1
-                                        ? config.hidden_activation
-                                        : config.output_activation;
-    auto activationFn = unaryActivation(activation);
+  preActivation = first_weights.row(topology.front());
+
+  for (SparseRowsMap::InnerIterator input(inputs, sample); input; ++input)
+    preActivation.noalias() += input.value() * first_weights.row(input.index());
+
+  activateLayer(workspace, 1);
+  generateLayers(workspace, 2);
+}
+
+void NeuralNetwork::generateLayers(Workspace &workspace,
+                                   Size first_layer) const {
+  for (Size layer_index = first_layer; layer_index < workspace.neurons.size();
+       layer_index++) {
 
-    neurons[layer_index]->block(0, 0, 1, num_to_update) =
-        preActivation[layer_index]
-            ->block(0, 0, 1, num_to_update)
-            .unaryExpr(activationFn);
+    Size num_to_update = weights[layer_index - 1].cols();
+
+    // calculate preActivation for this layer (excluding bias)
+    workspace.preActivation[layer_index]
+        .block(0, 0, 1, num_to_update)
+        .noalias() =
+        workspace.neurons[layer_index - 1] * weights[layer_index - 1];
+
+    activateLayer(workspace, layer_index);
   }
-  // return output layer
-  return *neurons.back();
 }
 
-void NeuralNetwork::propogateError(Vector expected) {
-  // NOTE: here we do not update the error, but sum it so that we can update
-  // weights after a btch of training examples. We will set the number of
-  // examples until weights are updated in the train function.
+void NeuralNetwork::activateLayer(Workspace &workspace,
+                                  Size layer_index) const {
+  Size num_to_update = weights[layer_index - 1].cols();
+
+  ActivationFunction activation =
+      layer_index < workspace.neurons.size() - 1 ? config.hidden_activation
+                                                 : config.output_activation;
 
-  (*error.back()) = (*neurons.back() - expected);
+  applyActivation(
+      activation,
+      workspace.preActivation[layer_index].block(0, 0, 1, num_to_update),
+      workspace.neurons[layer_index].block(0, 0, 1, num_to_update));
+}
 
+void NeuralNetwork::propogateError(Workspace &workspace) {
   // calculate error for hidden layers
-  for (Size layer_index = error.size() - 2; layer_index >= 0; layer_index--) {
+  for (Size layer_index = workspace.error.size() - 1; layer_index-- > 0;) {
     // calculate error for hidden layers
 
-    Size erring_neurons = error[layer_index + 1]->size() - 1;
-
-    if (layer_index == error.size() - 2)
-      erring_neurons++;
+    Size erring_neurons = weights[layer_index + 1].cols();
 
     // calculate error for this layer
-    (*error[layer_index]) =
-        error[layer_index + 1]->block(0, 0, 1, erring_neurons) *
-        weights[layer_index + 1]->transpose();
-    ;
-
-    auto activation = layer_index < error.size() - 2 ? config.hidden_activation
-                                                     : config.output_activation;
-
-    auto deActivation = unaryActivationDerivative(
-        layer_index < error.size() - 2 ? config.hidden_activation
-                                       : config.output_activation);
+    workspace.error[layer_index].noalias() =
+        workspace.error[layer_index + 1].block(0, 0, 1, erring_neurons) *
+        weights[layer_index + 1].transpose();
 
-    (*error[layer_index]) = error[layer_index]->cwiseProduct(
-        preActivation[layer_index + 1]->unaryExpr(deActivation));
+    // every layer below the output is hidden, and the derivative comes from
+    // the neuron values stored by generate.
+    applyActivationDerivative(config.hidden_activation,
+                              workspace.neurons[layer_index + 1],
+                              workspace.error[layer_index]);
 
-    if (error[layer_index]->hasNaN()) {
-      std::cout << "NaN in error!" << '\n' << *error[layer_index] << '\n';
+    if (workspace.error[layer_index].hasNaN()) {
+      std::cout << "NaN in error!" << '\n' << workspace.error[layer_index]
+                << '\n';
       throw std::invalid_argument("Nan in error");
     }
-
-    if (layer_index == 0)
-      return; // HACK: WTF?
   }
 }
 
-void NeuralNetwork::resetError() {
-  for (Size layer_index = 0; layer_index < error.size(); layer_index++) {
-    error[layer_index]->setZero();
+void NeuralNetwork::resetError(Workspace &workspace) {
+  for (Size layer_index = 0; layer_index < workspace.error.size();
+       layer_index++) {
+    workspace.error[layer_index].setZero();
   }
 }
 
-void NeuralNetwork::updateWeights(Scalar learning_rate) {
+void NeuralNetwork::updateWeights(Workspace &workspace, Scalar learning_rate,
+                                  Size first_layer) {
 
   // update weights based on error and learning rate
-  for (Size layer_index = 0; layer_index < weights.size(); layer_index++) {
+  for (Size layer_index = first_layer; layer_index < weights.size();
+       layer_index++) {
 
-    Matrix *layer_weights = weights[layer_index];
+    MatrixMap &layer_weights = weights[layer_index];
 
-    for (int col = 0; col < layer_weights->cols(); col++) {
-      for (int row = 0; row < layer_weights->rows(); row++) {
-        Scalar delta = learning_rate * error[layer_index]->coeffRef(col) *
-                       neurons[layer_index]->coeffRef(row);
-        layer_weights->coeffRef(row, col) -= delta;
-      }
-    }
+    // rank-1 update, in place
+    layer_weights.noalias() -=
+        workspace.neurons[layer_index].transpose() *
+        (learning_rate *
+         workspace.error[layer_index].head(layer_weights.cols()));
   }
 }
 
-Vector NeuralNetwork::teach(Vector input, Vector expected,
-                            Scalar learning_rate) {
+void NeuralNetwork::updateSparseWeights(Workspace &workspace,
+                                        const SparseRowsMap &inputs, Size sample,
+                                        Scalar learning_rate) {
+  MatrixMap &first_weights = weights.front();
+  auto error = workspace.error.front().head(first_weights.cols());
+
+  // the rank-1 update is zero on every row of a zero input
+  for (SparseRowsMap::InnerIterator input(inputs, sample); input; ++input)
+    first_weights.row(input.index()).noalias() -=
+        (learning_rate * input.value()) * error;
+
+  first_weights.row(topology.front()).noalias() -= learning_rate * error;
+}
+
+Scalar NeuralNetwork::teach(Workspace &workspace, const Dataset &data,
+                            Size sample, Scalar learning_rate, Scalar weight) {
   // generate output
-  generate(input);
+  if (data.sparse())
+    generateSparse(workspace, data.sparseInputs(), sample);
+  else {
+    // widened (if encoded) straight into the input layer
+    data.readInput(sample, workspace.neurons.front().head(topology.front()));
+    generateLayers(workspace, 1);
+  }
+
+  // error of the output layer. against a label this is the output itself,
+  // less one for the right class, without building a one-hot vector.
+  if (data.labelled()) {
+    workspace.error.back() = workspace.neurons.back();
+    workspace.error.back()(data.label(sample)) -= 1.0;
+  } else {
+    workspace.error.back() = workspace.neurons.back() - data.target(sample);
+  }
+
+  Scalar score = workspace.error.back().cwiseAbs().sum();
+
+  if (weight != 1.0)
+    workspace.error.back() *= weight;
+
   // propogate error
-  propogateError(expected);
-  Vector score = *error.back();
+  propogateError(workspace);
   // update weights
-  updateWeights(learning_rate);
+  if (data.sparse()) {
+    updateWeights(workspace, learning_rate, 1);
+    updateSparseWeights(workspace, data.sparseInputs(), sample, learning_rate);
+  } else {
+    updateWeights(workspace, learning_rate);
+  }
   // reset error
-  resetError();
+  resetError(workspace);
 
   return score;
 }
 
+void NeuralNetwork::initialiseBatch(BatchWorkspace &batch, Size capacity,
+                                    bool training, bool sparse) const {
+  batch.capacity = capacity;
+
+  batch.neurons.clear();
+  batch.preActivation.clear();
+  batch.error.clear();
+  batch.gradient.clear();
+
+  Size size = training ? NetworkArena::padded(capacity * topology.back()) +
+                             weightsSize()
+                       : 0;
+
+  if (training && sparse)
+    size -= NetworkArena::padded(weights[0].size());
+
+  for (Size layer_index = sparse ? 1 : 0; layer_index < topology.size();
+       layer_index++)
+    size += NetworkArena::padded(capacity * layerSize(layer_index)) *
+            (training && layer_index != 0 ? 3 : 2);
+
+  batch.arena.allocate(size);
+
+  for (Size layer_index = 0; layer_index < topology.size(); layer_index++) {
+    // same layout as a single sample, with bias columns on all but the output
+    Size layer_size = layerSize(layer_index);
+
+    if (sparse && layer_index == 0) {
+      // the first layer reads the sparse rows themselves
+      batch.neurons.push_back(MatrixMap(nullptr, capacity, 0));
+      batch.preActivation.push_back(MatrixMap(nullptr, capacity, 0));
+      continue;
+    }
+
+    batch.neurons.push_back(
+        MatrixMap(batch.arena.take(capacity * layer_size), capacity,
+                  layer_size));
+    batch.preActivation.push_back(
+        MatrixMap(batch.arena.take(capacity * layer_size), capacity,
+                  layer_size));
+    if (training && layer_index != 0)
+      batch.error.push_back(
+          MatrixMap(batch.arena.take(capacity * layer_size), capacity,
+                    layer_size));
+
+    // bias column is 1 for every sample
+    if (layer_index != topology.size() - 1) {
+      batch.neurons.back().col(layer_size - 1).setOnes();
+      batch.preActivation.back().col(layer_size - 1).setOnes();
+    }
+  }
+
+  if (sparse)
+    batch.sparse_row.resize(weights[0].cols());
+
+  if (!training)
+    return;
+
+  batch.sample_labels.resize(capacity);
+  batch.sample_weights.resize(capacity);
+
+  // Map views are re-pointed with placement new, as Eigen recommends
+  new (&batch.expected)
+      MatrixMap(batch.arena.take(capacity * topology.back()), capacity,
+                topology.back());
+
+  for (Size layer_index = 0; layer_index < weights.size(); layer_index++) {
+    Size n = weights[layer_index].rows();
+    Size m = weights[layer_index].cols();
+
+    if (sparse && layer_index == 0) {
+      // kept for the touched rows only, in sparse_gradient
+      batch.gradient.push_back(MatrixMap(nullptr, 0, 0));
+      continue;
+    }
+
+    batch.gradient.push_back(MatrixMap(batch.arena.take(n * m), n, m));
+  }
+}
+
+void NeuralNetwork::loadBatch(BatchWorkspace &batch, const Dataset &data,
+                              Size first, Size rows,
+                              const std::vector<Size> *samples) {
+  if (samples != nullptr) {
+    // the samples of a view are scattered, so they are gathered row by row
+    const Size *indices = samples->data() + first;
+
+    if (data.sparse()) {
+      batch.sparse_inputs.emplace(data.sparseInputs());
+      batch.sparse_rows = indices;
+    } else {
+      batch.sparse_inputs.reset();
+      for (Size row = 0; row < rows; row++)
+        data.readInput(indices[row],
+                       batch.neurons.front().row(row).head(topology.front()));
+    }
+
+    if (data.labelled()) {
+      for (Size row = 0; row < rows; row++)
+        batch.sample_labels[row] = data.label(indices[row]);
+      batch.labels = batch.sample_labels.data();
+    } else {
+      batch.labels = nullptr;
+      for (Size row = 0; row < rows; row++)
+        batch.expected.row(row) = data.target(indices[row]);
+    }
+
+    return;
+  }
+
+  // two block copies (or column decodes), the rows of a batch are next to
+  // each other
+  batch.sparse_rows = nullptr;
+
+  if (data.sparse()) {
+    batch.sparse_inputs.emplace(data.sparseInputs());
+    batch.sparse_first = first;
+  } else {
+    batch.sparse_inputs.reset();
+    data.readInputs(first, rows,
+                    batch.neurons.front().block(0, 0, rows, topology.front()));
+  }
+
+  if (data.labelled()) {
+    batch.labels = data.labelData() + first;
+  } else {
+    batch.labels = nullptr;
+    batch.expected.topRows(rows) = data.targetBatch(first, rows);
+  }
+}
+
+void NeuralNetwork::generateBatch(BatchWorkspace &batch, Size rows) const {
+  for (Size layer_index = 1; layer_index < topology.size(); layer_index++) {
+
+    Size num_to_update = weights[layer_index - 1].cols();
+
+    // one matrix-matrix product for the whole batch (excluding bias)
+    auto preActivation =
+        batch.preActivation[layer_index].topLeftCorner(rows, num_to_update);
+
+    if (layer_index == 1 && batch.sparse_inputs) {
+      // the bias row plus the weights of each row's non-zero inputs, summed
+      // in a contiguous scratch row (a row of preActivation is strided)
+      Size input_size = topology.front();
+      Vector &sum = batch.sparse_row;
+
+      for (Size row = 0; row < rows; row++) {
+        sum = weights[0].row(input_size).transpose();
+
+        for (SparseRowsMap::InnerIterator input(*batch.sparse_inputs,
+                                                batch.sparseRow(row));
+             input; ++input)
+          sum.noalias() +=
+              input.value() * weights[0].row(input.index()).transpose();
+
+        preActivation.row(row) = sum.transpose();
+      }
+    } else {
+      preActivation.noalias() = batch.neurons[layer_index - 1].topRows(rows) *
+                                weights[layer_index - 1];
+    }
+
+    ActivationFunction activation = layer_index < topology.size() - 1
+                                        ? config.hidden_activation
+                                        : config.output_activation;
+
+    applyActivation(
+        activation, preActivation,
+        batch.neurons[layer_index].topLeftCorner(rows, num_to_update));
+  }
+}
+
+Size NeuralNetwork::inferenceBatchSize() const {
+  // pre-activations and neuron values of every layer, per sample
+  Size bytes_per_sample = 0;
+
+  for (Size layer_index = 0; layer_index < topology.size(); layer_index++)
+    bytes_per_sample += 2 * layerSize(layer_index) * sizeof(Scalar);
+
+  Size batch_size = INFERENCE_CACHE_BYTES / bytes_per_sample;
+
+  return std::max<Size>(8, std::min<Size>(batch_size, 1024));
+}
+
+void NeuralNetwork::generateBatch(const Eigen::Ref<const RowMatrix> &inputs,
+                                  Matrix &outputs) const {
+  generateBatches(inputs.rows(), outputs, false,
+                  [&](BatchWorkspace &batch, Size first, Size rows) {
+                    batch.neurons.front().block(0, 0, rows, topology.front()) =
+                        inputs.middleRows(first, rows);
+                  });
+}
+
+void NeuralNetwork::generateBatch(const SparseRowsMap &inputs,
+                                  Matrix &outputs) const {
+  generateBatches(inputs.rows(), outputs, true,
+                  [&](BatchWorkspace &batch, Size first, Size) {
+                    batch.sparse_inputs.emplace(inputs);
+                    batch.sparse_first = first;
+                  });
+}
+
+void NeuralNetwork::generateBatches(
+    Size samples, Matrix &outputs, bool sparse,
+    std::function<void(BatchWorkspace &batch, Size first, Size rows)> load)
+    const {
+  Size batch_size = std::min<Size>(inferenceBatchSize(), samples);
+
+  {
+    AllocationCheckPause pause;
+    outputs.resize(samples, topology.back());
+  }
+
+  if (samples == 0)
+    return;
+
+  Size batches = (samples + batch_size - 1) / batch_size;
+  Size workers = std::min<Size>(pool ? pool->size() : 1, batches);
+
+  // every worker takes every `workers`th batch, with its own buffers
+  parallel_for(pool, 0, workers, [&](Size worker) {
+    BatchWorkspace batch;
+
+    {
+      AllocationCheckPause pause;
+      initialiseBatch(batch, batch_size, false, sparse);
+    }
+
+    for (Size index = worker; index < batches; index += workers) {
+      Size first = index * batch_size;
+      Size rows = std::min<Size>(batch_size, samples - first);
+
+      load(batch, first, rows);
+
+      generateBatch(batch, rows);
+
+      outputs.middleRows(first, rows) = batch.neurons.back().topRows(rows);
+    }
+  });
+}
+
+Scalar NeuralNetwork::propogateBatchError(BatchWorkspace &batch, Size rows) {
+  // same scheme as propogateError, with one sample per row.
+
+  Size last = batch.error.size() - 1;
+
+  if (batch.labels != nullptr) {
+    batch.error[last].topRows(rows) = batch.neurons.back().topRows(rows);
+
+    for (Size row = 0; row < rows; row++)
+      batch.error[last](row, batch.labels[row]) -= 1.0;
+  } else {
+    batch.error[last].topRows(rows) =
+        batch.neurons.back().topRows(rows) - batch.expected.topRows(rows);
+  }
+
+  Scalar score = batch.error[last].topRows(rows).cwiseAbs().sum();
+
+  if (batch.losses != nullptr)
+    for (Size row = 0; row < rows; row++)
+      batch.losses[row] = batch.error[last].row(row).cwiseAbs().sum();
+
+  if (batch.weights != nullptr)
+    for (Size row = 0; row < rows; row++)
+      batch.error[last].row(row) *= batch.weights[row];
+
+  for (Size layer_index = last; layer_index-- > 0;) {
+    Size erring_neurons = weights[layer_index + 1].cols();
+
+    auto layer_error = batch.error[layer_index].topRows(rows);
+
+    layer_error.noalias() =
+        batch.error[layer_index + 1].topLeftCorner(rows, erring_neurons) *
+        weights[layer_index + 1].transpose();
+
+    applyActivationDerivative(config.hidden_activation,
+                              batch.neurons[layer_index + 1].topRows(rows),
+                              layer_error);
+
+    if (layer_error.hasNaN()) {
+      std::cout << "NaN in error!" << '\n' << layer_error << '\n';
+      throw std::invalid_argument("Nan in error");
+    }
+  }
+
+  return score;
+}
+
+Scalar NeuralNetwork::computeBatchGradient(BatchWorkspace &batch, Size rows) {
+  generateBatch(batch, rows);
+  Scalar score = propogateBatchError(batch, rows);
+
+  Size first_layer = 0;
+
+  if (batch.sparse_inputs) {
+    // only the rows of the inputs the batch touches have any gradient
+    const SparseRowsMap &inputs = *batch.sparse_inputs;
+    Size hidden = weights[0].cols();
+
+    batch.touched.clear();
+
+    for (Size row = 0; row < rows; row++)
+      for (SparseRowsMap::InnerIterator input(inputs, batch.sparseRow(row));
+           input; ++input)
+        batch.touched.push_back(input.index());
+
+    std::sort(batch.touched.begin(), batch.touched.end());
+    batch.touched.erase(std::unique(batch.touched.begin(), batch.touched.end()),
+                        batch.touched.end());
+
+    Size touched_rows = batch.touched.size() + 1;
+
+    if (batch.sparse_gradient.rows() < (Eigen::Index)touched_rows)
+      batch.sparse_gradient.resize(
+          std::max<Size>(touched_rows, 2 * batch.sparse_gradient.rows()),
+          hidden);
+    batch.sparse_gradient.topRows(touched_rows).setZero();
+
+    for (Size row = 0; row < rows; row++) {
+      // a contiguous copy of the row's error, read once per non-zero input
+      Vector &error = batch.sparse_row;
+      error = batch.error[0].row(row).head(hidden).transpose();
+
+      for (SparseRowsMap::InnerIterator input(inputs, batch.sparseRow(row));
+           input; ++input) {
+        Size touched_row =
+            std::lower_bound(batch.touched.begin(), batch.touched.end(),
+                             (Size)input.index()) -
+            batch.touched.begin();
+
+        batch.sparse_gradient.row(touched_row).noalias() +=
+            input.value() * error.transpose();
+      }
+
+      batch.sparse_gradient.row(batch.touched.size()) += error.transpose();
+    }
+
+    first_layer = 1;
+  }
+
+  // gradient of each layer is the product of its inputs and the error of the
+  // layer it feeds, summed over the batch by the matrix product.
+  for (Size layer_index = first_layer; layer_index < weights.size();
+       layer_index++) {
+    batch.gradient[layer_index].noalias() =
+        batch.neurons[layer_index].topRows(rows).transpose() *
+        batch.error[layer_index].topLeftCorner(rows,
+                                               weights[layer_index].cols());
+  }
+
+  return score;
+}
+
+void NeuralNetwork::applyGradient(NetworkWeights &gradient,
+                                  Scalar learning_rate, Size first_layer) {
+  for (Size layer_index = first_layer; layer_index < weights.size();
+       layer_index++)
+    weights[layer_index] -= learning_rate * gradient[layer_index];
+}
+
+void NeuralNetwork::applySparseGradient(BatchWorkspace &batch,
+                                        Scalar learning_rate) {
+  MatrixMap &first_weights = weights.front();
+
+  for (Size row = 0; row < batch.touched.size(); row++)
+    first_weights.row(batch.touched[row]) -=
+        learning_rate * batch.sparse_gradient.row(row);
+
+  first_weights.row(topology.front()) -=
+      learning_rate * batch.sparse_gradient.row(batch.touched.size());
+}
+
+void NeuralNetwork::initialiseTraining(TrainingState &state) {
+  // the buffers are laid out once per run, not per epoch
+  AllocationCheckPause pause;
+
+  state.hogwild = config.mode == HOGWILD;
+  state.batched = !state.hogwild && config.batch_size > 1;
+
+  // each batch (or for HOGWILD, the whole data set) is split into one
+  // contiguous slice per worker, with every worker keeping its own buffers.
+  state.workers = 1;
+
+  if (state.hogwild || state.batched)
+    state.workers = config.threads ? config.threads : pool ? pool->size() : 1;
+
+  state.slice = (config.batch_size + state.workers - 1) / state.workers;
+
+  state.batches = std::vector<BatchWorkspace>(state.batched ? state.workers : 0);
+  state.workspaces = std::vector<Workspace>(state.hogwild ? state.workers : 0);
+  state.worker_errors = std::vector<Scalar>(state.workers);
+
+  state.laid_out = false;
+
+  for (auto &workspace : state.workspaces)
+    initialiseWorkspace(workspace);
+}
+
+// the order to train on `count` samples in for an epoch, by the config's
+// shuffle mode. with `samples`, the order is of those samples (a view's), and
+// otherwise of the first `count` of the data set. returns nullptr for the
+// data set's own order. `part` tells apart the chunks of a streamed epoch.
+static const std::vector<Size> *
+epochOrder(const Configuration &config, Size epoch, Size part, Size count,
+           const std::vector<Size> *samples, std::vector<Size> &order) {
+  if (config.shuffle == SHUFFLE_NONE)
+    return samples;
+
+  std::seed_seq seed{config.seed, epoch, part};
+  std::mt19937 generator(seed);
+
+  order.resize(count);
+  std::iota(order.begin(), order.end(), 0);
+
+  if (config.shuffle == SHUFFLE_FULL) {
+    std::shuffle(order.begin(), order.end(), generator);
+  } else {
+    Size block = config.shuffle_block;
+    Size blocks = (count + block - 1) / block;
+
+    // the blocks in a random order, each shuffled within itself
+    std::vector<Size> block_order(blocks);
+    std::iota(block_order.begin(), block_order.end(), 0);
+    std::shuffle(block_order.begin(), block_order.end(), generator);
+
+    Size position = 0;
+
+    for (Size index : block_order) {
+      Size first = index * block;
+      Size size = std::min(block, count - first);
+
+      std::iota(order.begin() + position, order.begin() + position + size,
+                first);
+      std::shuffle(order.begin() + position, order.begin() + position + size,
+                   generator);
+
+      position += size;
+    }
+  }
+
+  if (samples != nullptr)
+    for (Size &sample : order)
+      sample = (*samples)[sample];
+
+  return &order;
+}
+
+// share of the probability of every sample spread evenly, so that samples with
+// a small loss are still revisited now and then, and their weight is bounded
+static const Scalar LOSS_SAMPLING_SMOOTHING = 0.1;
+
+// the samples to train on for an epoch of `count` samples (those of a view,
+// with `samples`) out of a data set of `data_size`. with loss sampling, the
+// first epoch trains on every sample to learn their losses, and later ones
+// draw from them by loss, setting the importance weights in `state`.
+// otherwise this is the shuffled (or not) order of epochOrder.
+static const std::vector<Size> *
+sampleOrder(const Configuration &config, Size epoch, Size data_size,
+            Size count, const std::vector<Size> *samples,
+            TrainingState &state, std::vector<Size> &order) {
+  if (config.sampling != SAMPLING_LOSS || count == 0)
+    return epochOrder(config, epoch, 0, count, samples, order);
+
+  if (state.losses.size() != data_size) {
+    state.losses.assign(data_size, 0.0);
+    state.importance.assign(data_size, 1.0);
+
+    return epochOrder(config, epoch, 0, count, samples, order);
+  }
+
+  auto sample = [samples](Size i) { return samples ? (*samples)[i] : i; };
+
+  double total_loss = 0.0;
+
+  for (Size i = 0; i < count; i++)
+    total_loss += state.losses[sample(i)];
+
+  std::vector<double> probabilities(count);
+
+  for (Size i = 0; i < count; i++) {
+    double share = total_loss > 0.0 ? state.losses[sample(i)] / total_loss
+                                    : 1.0 / count;
+    probabilities[i] = (1.0 - LOSS_SAMPLING_SMOOTHING) * share +
+                       LOSS_SAMPLING_SMOOTHING / count;
+
+    // E[weight * gradient] over the draws is then the mean gradient
+    state.importance[sample(i)] = 1.0 / (count * probabilities[i]);
+  }
+
+  std::seed_seq seed{config.seed, epoch, (Size)1};
+  std::mt19937 generator(seed);
+  std::discrete_distribution<Size> distribution(probabilities.begin(),
+                                                probabilities.end());
+
+  Size draws = std::max<Size>(1, std::lround(count * config.sample_fraction));
+
+  order.resize(draws);
+
+  for (Size &drawn : order)
+    drawn = sample(distribution(generator));
+
+  return &order;
+}
+
+Scalar NeuralNetwork::trainChunk(TrainingState &state, const Dataset &data,
+                                 Scalar learning_rate,
+                                 const std::vector<Size> *samples) {
+  Scalar res_error = 0.0;
+
+  // the i-th sample to train on
+  Size total = samples ? samples->size() : data.size();
+  auto sample = [samples](Size i) { return samples ? (*samples)[i] : i; };
+
+  Size workers = state.workers;
+  Size slice = state.slice;
+  std::vector<Scalar> &worker_errors = state.worker_errors;
+
+  // loss sampling keeps the loss of every sample trained on, and scales each
+  // sample's error by its importance weight
+  bool sampling = !state.losses.empty();
+
+  if (sampling)
+    state.visit_losses.resize(total);
+
+  auto weight = [&state, sampling](Size index) -> Scalar {
+    return sampling ? state.importance[index] : 1.0;
+  };
+
+  if (state.hogwild) {
+    NoMallocScope no_malloc;
+
+    // no locks or barriers inside the epoch: workers race on the shared
+    // weights, which is fine as long as updates rarely touch the same
+    // coefficients at once.
+    parallel_for(pool, 0, workers, [&](Size worker) {
+      Size begin = (size_t)total * worker / workers;
+      Size end = (size_t)total * (worker + 1) / workers;
+
+      worker_errors[worker] = 0.0;
+
+      for (Size i = begin; i < end; i++) {
+        Scalar score = teach(state.workspaces[worker], data, sample(i),
+                             learning_rate, weight(sample(i)));
+
+        if (sampling)
+          state.visit_losses[i] = score;
+
+        worker_errors[worker] += score;
+      }
+    });
+
+    for (Size worker = 0; worker < workers; worker++)
+      res_error += worker_errors[worker];
+  } else if (state.batched) {
+    // with sparse inputs the first layer's gradient is kept separately
+    Size first_layer = data.sparse() ? 1 : 0;
+
+    if (!state.laid_out || state.sparse != data.sparse()) {
+      AllocationCheckPause pause;
+
+      for (BatchWorkspace &batch : state.batches)
+        initialiseBatch(batch, slice, true, data.sparse());
+
+      state.laid_out = true;
+      state.sparse = data.sparse();
+    }
+
+    // the gradient is summed (not averaged) over the batch, so the learning
+    // rate keeps the same per-sample meaning as in the unbatched path.
+    for (Size first = 0; first < total; first += config.batch_size) {
+      Size rows = std::min<Size>(config.batch_size, total - first);
+
+      parallel_for(pool, 0, workers, [&](Size worker) {
+        BatchWorkspace &batch = state.batches[worker];
+        Size begin = std::min(worker * slice, rows);
+        Size count = std::min(slice, rows - begin);
+
+        if (count == 0) {
+          for (Size layer = first_layer; layer < weights.size(); layer++)
+            batch.gradient[layer].setZero();
+          batch.touched.clear();
+          if (data.sparse()) {
+            if (batch.sparse_gradient.rows() == 0)
+              batch.sparse_gradient.resize(1, weights[0].cols());
+            batch.sparse_gradient.row(0).setZero();
+          }
+          worker_errors[worker] = 0.0;
+          return;
+        }
+
+        loadBatch(batch, data, first + begin, count, samples);
+
+        if (sampling) {
+          for (Size row = 0; row < count; row++)
+            batch.sample_weights[row] = weight(sample(first + begin + row));
+
+          batch.weights = batch.sample_weights.data();
+          batch.losses = state.visit_losses.data() + first + begin;
+        } else {
+          batch.weights = nullptr;
+          batch.losses = nullptr;
+        }
+
+        worker_errors[worker] = computeBatchGradient(batch, count);
+      });
+
+      reduceGradients(state.batches, pool, first_layer);
+      applyGradient(state.batches.front().gradient, learning_rate,
+                    first_layer);
+
+      // each worker's touched rows in turn, so the order stays fixed
+      if (data.sparse())
+        for (BatchWorkspace &batch : state.batches)
+          applySparseGradient(batch, learning_rate);
+
+      for (Size worker = 0; worker < workers; worker++)
+        res_error += worker_errors[worker];
+    }
+  } else {
+    NoMallocScope no_malloc;
+
+    for (Size i = 0; i < total; i++) {
+      Scalar score =
+          teach(workspace, data, sample(i), learning_rate, weight(sample(i)));
+
+      if (sampling)
+        state.visit_losses[i] = score;
+
+      res_error += score;
+    }
+  }
+
+  // a sample drawn twice keeps its last loss
+  if (sampling)
+    for (Size i = 0; i < total; i++)
+      state.losses[sample(i)] = state.visit_losses[i];
+
+  return res_error;
+}
+
 void NeuralNetwork::train(
-    TrainingData data, Size epochs,
+    const Dataset &data, Size epochs,
     std::function<int(Size epoch, Scalar error, Scalar learning_rate)>
         trainStatisticHook) {
 
-  Scalar first_error, last_error;
+  TrainingState state;
+  initialiseTraining(state);
+
+  std::vector<Size> order;
 
   // train the network with a set of examples
   for (Size epoch = 0; epoch < epochs; epoch++) {
 
-    Scalar res_error = 0.0;
-
     // calculate dynamic learning rate
 
     Scalar dynamic_learning_rate =
         dyn_learning_rate(config.top_rate, config.bot_rate, config.cycle_length,
                           config.decay_rate, epoch);
 
-    for (Size i = 0; i < data.size(); i++) {
-      Vector score =
-          teach(data[i].input, data[i].expected, dynamic_learning_rate);
-      res_error += score.unaryExpr(&sabs).sum();
+    const std::vector<Size> *samples =
+        sampleOrder(config, epoch, data.size(), data.size(), nullptr, state,
+                    order);
+
+    Scalar res_error =
+        trainChunk(state, data, dynamic_learning_rate, samples);
+
+    res_error /= samples ? samples->size() : data.size();
+
+    trainStatisticHook(epoch, res_error, dynamic_learning_rate);
+  }
+}
+
+void NeuralNetwork::train(
+    DataSource &source, Size epochs,
+    std::function<int(Size epoch, Scalar error, Scalar learning_rate)>
+        trainStatisticHook) {
+
+  TrainingState state;
+  initialiseTraining(state);
+
+  Dataset chunk;
+  std::vector<Size> order;
+
+  for (Size epoch = 0; epoch < epochs; epoch++) {
+
+    Scalar dynamic_learning_rate =
+        dyn_learning_rate(config.top_rate, config.bot_rate, config.cycle_length,
+                          config.decay_rate, epoch);
+
+    Scalar res_error = 0.0;
+    size_t samples = 0;
+
+    // the source reads ahead on its own thread while we train on this chunk
+    source.rewind();
+
+    // chunks come in file order, and are each shuffled on their own
+    for (Size part = 0; source.next(chunk); part++) {
+      res_error += trainChunk(
+          state, chunk, dynamic_learning_rate,
+          epochOrder(config, epoch, part, chunk.size(), nullptr, order));
+      samples += chunk.size();
     }
 
-    res_error /= data.size();
+    if (samples > 0)
+      res_error /= samples;
+
+    trainStatisticHook(epoch, res_error, dynamic_learning_rate);
+  }
+}
+
+void NeuralNetwork::train(
+    const DatasetView &data, Size epochs,
+    std::function<int(Size epoch, Scalar error, Scalar learning_rate)>
+        trainStatisticHook) {
+
+  TrainingState state;
+  initialiseTraining(state);
+
+  std::vector<Size> order;
+
+  for (Size epoch = 0; epoch < epochs; epoch++) {
+
+    Scalar dynamic_learning_rate =
+        dyn_learning_rate(config.top_rate, config.bot_rate, config.cycle_length,
+                          config.decay_rate, epoch);
+
+    const std::vector<Size> *samples =
+        sampleOrder(config, epoch, data.data->size(), data.size(),
+                    &data.samples, state, order);
 
-    if (epoch == 0)
-      first_error = res_error;
+    Scalar res_error =
+        trainChunk(state, *data.data, dynamic_learning_rate, samples);
 
-    if (epoch == epochs - 1)
-      last_error = res_error;
+    res_error /= samples->size();
 
     trainStatisticHook(epoch, res_error, dynamic_learning_rate);
   }
 }
 
-Scalar NeuralNetwork::test(TrainingData data,
-                    std::function<int(Vector, Vector, Scalar)> testHook) {
+void NeuralNetwork::trainTogether(
+    std::vector<NeuralNetwork> &networks, const std::vector<DatasetView> &data,
+    Size epochs,
+    std::function<int(Size network, Size epoch, Scalar error,
+                      Scalar learning_rate)>
+        trainStatisticHook) {
+  if (networks.empty())
+    return;
+
+  ThreadPool *pool = networks.front().pool;
+
+  // every buffer is allocated up front, so nothing allocates while the
+  // networks train side by side
+  std::vector<TrainingState> states(networks.size());
+  std::vector<Scalar> errors(networks.size());
+  std::vector<Scalar> rates(networks.size());
+  std::vector<std::vector<Size>> orders(networks.size());
+
+  for (Size index = 0; index < networks.size(); index++)
+    networks[index].initialiseTraining(states[index]);
+
+  for (Size epoch = 0; epoch < epochs; epoch++) {
+    // one task per network, each free to split its own work further
+    parallel_for(pool, 0, networks.size(), [&](Size index) {
+      NeuralNetwork &network = networks[index];
+      const Configuration &config = network.config;
+
+      rates[index] = dyn_learning_rate(config.top_rate, config.bot_rate,
+                                       config.cycle_length, config.decay_rate,
+                                       epoch);
+
+      const std::vector<Size> *samples =
+          sampleOrder(config, epoch, data[index].data->size(),
+                      data[index].size(), &data[index].samples,
+                      states[index], orders[index]);
+
+      errors[index] = network.trainChunk(states[index], *data[index].data,
+                                         rates[index], samples);
+      errors[index] /= samples->size();
+    });
+
+    for (Size index = 0; index < networks.size(); index++)
+      trainStatisticHook(index, epoch, errors[index], rates[index]);
+  }
+}
+
+Scalar NeuralNetwork::test(
+    const Dataset &data,
+    std::function<int(const VectorView &, const VectorView &, Scalar)>
+        testHook) {
+  return testSamples(data, nullptr, testHook);
+}
+
+Scalar NeuralNetwork::test(
+    const DatasetView &data,
+    std::function<int(const VectorView &, const VectorView &, Scalar)>
+        testHook) {
+  return testSamples(*data.data, &data.samples, testHook);
+}
+
+Scalar NeuralNetwork::testSamples(
+    const Dataset &data, const std::vector<Size> *samples,
+    std::function<int(const VectorView &, const VectorView &, Scalar)>
+        testHook) {
   // test the network with a set of examples
 
   Scalar accuracy = 0.0;
 
-  for (Size i = 0; i < data.size(); i++) {
-    Vector output = generate(data[i].input);
-    auto error = (output - data[i].expected).unaryExpr(&sabs).sum();
-    testHook(data[i].input, output, error);
+  // run the whole data set through the network in batches, then report the
+  // results in order.
+  Matrix outputs;
+
+  Size total = samples ? samples->size() : data.size();
+  auto sample = [samples](Size i) { return samples ? (*samples)[i] : i; };
+
+  if (samples != nullptr) {
+    // the samples of a view are gathered a batch at a time
+    generateBatches(total, outputs, data.sparse(),
+                    [&](BatchWorkspace &batch, Size first, Size rows) {
+                      if (data.sparse()) {
+                        batch.sparse_inputs.emplace(data.sparseInputs());
+                        batch.sparse_rows = samples->data() + first;
+                        return;
+                      }
+
+                      for (Size row = 0; row < rows; row++)
+                        data.readInput(
+                            (*samples)[first + row],
+                            batch.neurons.front().row(row).head(
+                                topology.front()));
+                    });
+  } else if (data.sparse()) {
+    generateBatch(data.sparseInputs(), outputs);
+  } else if (data.isEncoded()) {
+    generateBatches(total, outputs, false,
+                    [&](BatchWorkspace &batch, Size first, Size rows) {
+                      data.readInputs(first, rows,
+                                      batch.neurons.front().block(
+                                          0, 0, rows, topology.front()));
+                    });
+  } else {
+    generateBatch(data.inputMatrix(), outputs);
+  }
+
+  // sparse (or encoded) inputs are only made dense for the hook, one at a
+  // time
+  Vector dense_input(data.inputSize());
+
+  auto input = [&](Size i) -> VectorView {
+    if (data.sparse())
+      dense_input = data.sparseInputs().row(i);
+    else if (data.isEncoded())
+      data.readInput(i, dense_input);
+    else
+      return data.input(i);
+
+    return dense_input;
+  };
+
+  for (Size i = 0; i < total; i++) {
+    auto output = outputs.row(i);
+    Size index = sample(i);
+
+    if (data.labelled()) {
+      // same absolute error as against a one-hot vector, and the sample is
+      // right if its class has the highest output.
+      Size label = data.label(index);
+      Scalar error = output.cwiseAbs().sum() - std::abs(output(label)) +
+                     std::abs(output(label) - 1.0f);
+      testHook(input(index), output, error);
+
+      Eigen::Index predicted;
+      output.maxCoeff(&predicted);
+      if ((Size)predicted == label)
+        accuracy++;
+      continue;
+    }
+
+    auto error = (output - data.target(index)).cwiseAbs().sum();
+    testHook(input(index), output, error);
     if (output.size() > 1) {
       auto max = output.maxCoeff();
-      if (output.unaryExpr([max](Scalar x) -> Scalar { return x == max ? 1.0 : 0.0; }) == data[i].expected)
+      if (output.unaryExpr([max](Scalar x) -> Scalar { return x == max ? 1.0 : 0.0; }) == data.target(index))
         accuracy++;
     } else {
       accuracy += error;
     }
   }
 
-  accuracy /= data.size();
+  accuracy /= total;
 
   return accuracy;
 }
@@ -2,8 +2,13 @@
 // helpful library for matmul etc.
 #include "Eigen/Eigen"
 
+#include <cstdint>
+#include <memory>
+#include <optional>
 #include <queue>
 
+class ThreadPool;
+
 // Here we can define some types that will be used
 
 // we will use floats for scalars
@@ -13,6 +18,15 @@ typedef float Scalar;
 typedef Eigen::RowVectorXf Vector;
 typedef Eigen::VectorXf VectorT;
 typedef Eigen::MatrixXf Matrix;
+// one sample per row, each row contiguous in memory
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+    RowMatrix;
+// mostly zero inputs, one sample per row in compressed sparse row (CSR) form
+typedef Eigen::SparseMatrix<Scalar, Eigen::RowMajor> SparseRows;
+// read-only views of samples, which may be in a data set's own matrices or in
+// memory shared with other processes
+typedef Eigen::Map<const RowMatrix> RowsMap;
+typedef Eigen::Map<const SparseRows> SparseRowsMap;
 
 // the topology of the neural network will be defined as a series of integers,
 // which determine the number of neurons in each layer, starting with the input
@@ -22,15 +36,358 @@ typedef std::vector<unsigned int> Topology;
 
 typedef unsigned int Size;
 
-typedef std::vector<Vector *> NetworkData;
-typedef std::vector<Matrix *> NetworkWeights;
+// A single aligned block of memory that a network's buffers are carved out of.
+// Keeping every layer next to each other helps the cache and TLB in the hot
+// loops, and lets a whole network be copied with one memcpy.
+class NetworkArena {
+public:
+  NetworkArena();
+  ~NetworkArena();
+
+  NetworkArena(const NetworkArena &) = delete;
+  NetworkArena &operator=(const NetworkArena &) = delete;
+
+  // moving keeps the block (and every view into it) where it is
+  NetworkArena(NetworkArena &&other);
+
+  // allocate room for `count` scalars (see padded), dropping any old block
+  void allocate(Size count);
+
+  // hand out the next `count` scalars, aligned for vectorised access
+  Scalar *take(Size count);
+
+  // copy the contents of another arena with the same layout
+  void copyFrom(const NetworkArena &other);
+
+  // number of scalars a buffer of `count` takes up in an arena
+  static Size padded(Size count);
+
+private:
+  Scalar *block;
+  Size capacity;
+  Size used;
+};
+
+// layers are exposed as views into an arena
+typedef Eigen::Map<Vector, Eigen::AlignedMax> VectorMap;
+typedef Eigen::Map<Matrix, Eigen::AlignedMax> MatrixMap;
+
+// read-only view of any row vector (a Vector, a Map, a row of a Matrix), so
+// samples can be passed around without being copied.
+typedef Eigen::Ref<const Vector, 0, Eigen::InnerStride<>> VectorView;
+
+typedef std::vector<VectorMap> NetworkData;
+typedef std::vector<MatrixMap> NetworkWeights;
 
-struct TrainingDatum {
-  Vector input;
-  Vector expected;
+// buffers for pushing a single sample through the network. kept apart from the
+// weights so that several threads can train the same network at once.
+struct Workspace {
+  NetworkArena arena;
+
+  // pre-activation function value for each layer's neurons
+  NetworkData preActivation;
+  // post-activation function (true) value for each layer's neurons
+  NetworkData neurons;
+  // calculated error for each layer's neurons
+  NetworkData error;
 };
 
-typedef std::vector<TrainingDatum> TrainingData;
+// batched counterpart of NetworkData, each sample in a batch is one row.
+typedef std::vector<MatrixMap> NetworkBatchData;
+
+// buffers used to push a whole batch of samples through the network at once,
+// so that every layer becomes a single matrix-matrix product.
+struct BatchWorkspace {
+  NetworkArena arena;
+
+  // number of rows (samples) the buffers can hold
+  Size capacity;
+
+  NetworkBatchData preActivation;
+  NetworkBatchData neurons;
+  NetworkBatchData error;
+
+  // expected output for each sample in the batch
+  MatrixMap expected{nullptr, 0, 0};
+  // or, for a labelled data set, the class of each sample (in the data set)
+  const Size *labels = nullptr;
+
+  // for sparse inputs, the batch is `rows` rows of these from `sparse_first`,
+  // and the first layer reads them instead of neurons[0]
+  std::optional<SparseRowsMap> sparse_inputs;
+  Size sparse_first = 0;
+  // or, for the samples of a view, the sparse row of each batch row
+  const Size *sparse_rows = nullptr;
+
+  // labels gathered for the samples of a view, room for `capacity`
+  std::vector<Size> sample_labels;
+
+  // importance weight of each row's error (nullptr = all 1), gathered into
+  // `sample_weights`
+  const Scalar *weights = nullptr;
+  std::vector<Scalar> sample_weights;
+  // if set, the (unweighted) loss of each row is written here
+  Scalar *losses = nullptr;
+
+  // weight gradient summed over the batch
+  NetworkWeights gradient;
+
+  // with sparse inputs, the first layer's gradient is only kept for the input
+  // rows that the batch touches (sorted in `touched`), with the bias last.
+  // row-major, as it is read and written a row at a time, and only ever
+  // grown, so just its first touched.size() + 1 rows are the gradient
+  std::vector<Size> touched;
+  RowMatrix sparse_gradient;
+  // the first layer's pre-activation of one sparse row, summed in one place
+  Vector sparse_row;
+
+  // the sparse row holding batch row `row`
+  Size sparseRow(Size row) const {
+    return sparse_rows ? sparse_rows[row] : sparse_first + row;
+  }
+};
+
+// Samples of a data set that live outside of it, in a segment shared with
+// other processes (see SharedDataset.h). the segment stays mapped as long as
+// `mapping` does.
+struct SharedSamples {
+  std::shared_ptr<const void> mapping;
+
+  Size samples = 0;
+  // columns of the dense blocks (0 for sparse inputs, or labelled outputs)
+  Size input_columns = 0, expected_columns = 0;
+  const Scalar *inputs = nullptr;
+  const Scalar *expected = nullptr;
+  const Size *labels = nullptr;
+
+  // CSR inputs, if `sparse_columns` > 0
+  Size sparse_columns = 0;
+  Eigen::Index nonzeros = 0;
+  const int *outer = nullptr;
+  const int *inner = nullptr;
+  const Scalar *values = nullptr;
+};
+
+// Inputs kept in the compact per-column encoding of a binary data set file
+// (see Dataset.h), which stays mapped as long as `mapping` does. they are only
+// widened to floats a batch (or a sample) at a time.
+struct EncodedInputs {
+  struct Column {
+    // a ColumnType, with its scale and offset
+    uint32_t type;
+    float scale, offset;
+    // the stored value of every sample
+    const char *values;
+  };
+
+  std::shared_ptr<const void> mapping;
+  std::vector<Column> columns;
+  // size of the stored values of all the columns
+  size_t bytes = 0;
+};
+
+// A data set, stored as two row-major matrices with one row per sample: all
+// the inputs, and all the expected outputs. Samples, batches and subsets are
+// views into them, so batching or splitting the data never copies it, and a
+// batch can go straight into a matrix product.
+//
+// Classification data sets can instead be labelled: each sample keeps just
+// the index of its class, and `expected` has no columns. Likewise mostly zero
+// inputs can be kept in `sparse_inputs`, leaving `inputs` without columns.
+// A data set read from an encoded file keeps its (dense) inputs `encoded`
+// instead, again leaving `inputs` without columns, so they are read through
+// readInputs() and readInput(), which widen them where they are needed.
+//
+// A data set attached from shared memory leaves all of these empty, and is
+// read-only: its samples are only reached through the accessors below, which
+// is what training and testing use.
+struct Dataset {
+  typedef Eigen::Block<RowsMap, 1, Eigen::Dynamic, true> Row;
+  typedef Eigen::Block<RowsMap, Eigen::Dynamic, Eigen::Dynamic, true> Rows;
+  typedef Eigen::IndexedView<RowsMap, std::vector<Size>,
+                             Eigen::internal::AllRange<Eigen::Dynamic>>
+      Subset;
+
+  RowMatrix inputs;
+  RowMatrix expected;
+
+  SparseRows sparse_inputs;
+
+  std::vector<Size> labels;
+  // number of classes, 0 unless labelled
+  Size classes = 0;
+
+  SharedSamples shared;
+
+  EncodedInputs encoded;
+
+  Dataset() {}
+  Dataset(Size input_size, Size output_size, Size samples = 0)
+      : inputs(samples, input_size), expected(samples, output_size) {}
+
+  bool isShared() const { return shared.mapping != nullptr; }
+  bool isEncoded() const { return encoded.mapping != nullptr; }
+  bool sparse() const {
+    return isShared() ? shared.sparse_columns > 0 : sparse_inputs.cols() > 0;
+  }
+  bool labelled() const { return classes > 0; }
+
+  Size size() const {
+    if (isShared())
+      return shared.samples;
+    return sparse() ? sparse_inputs.rows() : inputs.rows();
+  }
+  bool empty() const { return size() == 0; }
+
+  Size inputSize() const {
+    if (isEncoded())
+      return encoded.columns.size();
+    return sparse() ? sparseInputs().cols() : inputMatrix().cols();
+  }
+  Size outputSize() const {
+    return labelled() ? classes : expectedMatrix().cols();
+  }
+
+  // all the samples, wherever they are stored
+  RowsMap inputMatrix() const {
+    if (isShared())
+      return RowsMap(shared.inputs, shared.samples, shared.input_columns);
+    return RowsMap(inputs.data(), inputs.rows(), inputs.cols());
+  }
+  RowsMap expectedMatrix() const {
+    if (isShared())
+      return RowsMap(shared.expected, shared.samples, shared.expected_columns);
+    return RowsMap(expected.data(), expected.rows(), expected.cols());
+  }
+  SparseRowsMap sparseInputs() const {
+    if (isShared())
+      return SparseRowsMap(shared.samples, shared.sparse_columns,
+                           shared.nonzeros, shared.outer, shared.inner,
+                           shared.values);
+    return SparseRowsMap(sparse_inputs.rows(), sparse_inputs.cols(),
+                         sparse_inputs.nonZeros(),
+                         sparse_inputs.outerIndexPtr(),
+                         sparse_inputs.innerIndexPtr(),
+                         sparse_inputs.valuePtr(),
+                         sparse_inputs.innerNonZeroPtr());
+  }
+  const Size *labelData() const {
+    return isShared() ? shared.labels : labels.data();
+  }
+  Size label(Size sample) const { return labelData()[sample]; }
+
+  // change the number of samples, keeping the first ones
+  void resize(Size samples) {
+    if (sparse())
+      sparse_inputs.conservativeResize(samples, sparse_inputs.cols());
+    inputs.conservativeResize(samples, Eigen::NoChange);
+    expected.conservativeResize(samples, Eigen::NoChange);
+    if (labelled())
+      labels.resize(samples);
+  }
+
+  // switch to sparse inputs if at most `density` of the inputs are non-zero.
+  // returns whether the inputs are now sparse.
+  bool useSparseInputs(Scalar density = 0.1);
+
+  // the inputs as dense rows
+  RowMatrix denseInputs() const;
+
+  // the dense inputs of `rows` samples from `first` (or of one sample) into
+  // `out`, widened if they are encoded
+  template <typename Out>
+  void readInputs(Size first, Size rows, Out &&out) const {
+    if (!isEncoded()) {
+      out = inputBatch(first, rows);
+      return;
+    }
+
+    for (Size column = 0; column < encoded.columns.size(); column++)
+      decodeInputs(column, first, rows, out.col(column));
+  }
+  template <typename Out> void readInput(Size sample, Out &&out) const {
+    if (!isEncoded()) {
+      out = input(sample);
+      return;
+    }
+
+    for (Size column = 0; column < encoded.columns.size(); column++)
+      out(column) = decodeInput(column, sample);
+  }
+
+  // one encoded input column of `rows` samples from `first`, or of a sample
+  void decodeInputs(Size column, Size first, Size rows,
+                    Eigen::Ref<VectorT, 0, Eigen::InnerStride<>> out) const;
+  Scalar decodeInput(Size column, Size sample) const;
+
+  // switch to labels if every expected output is one-hot (with more than one
+  // output). returns whether the data set is now labelled.
+  bool useLabels();
+
+  // the expected outputs as dense rows, one-hot for a labelled data set
+  RowMatrix targets() const;
+
+  // one sample (of inputs that are not encoded, see readInput)
+  Row input(Size sample) const { return inputMatrix().row(sample); }
+  Row target(Size sample) const { return expectedMatrix().row(sample); }
+
+  // `rows` consecutive samples from `first`
+  Rows inputBatch(Size first, Size rows) const {
+    return inputMatrix().middleRows(first, rows);
+  }
+  Rows targetBatch(Size first, Size rows) const {
+    return expectedMatrix().middleRows(first, rows);
+  }
+
+  // the samples at `indices`, in that order
+  Subset inputSubset(const std::vector<Size> &indices) const {
+    return inputMatrix()(indices, Eigen::all);
+  }
+  Subset targetSubset(const std::vector<Size> &indices) const {
+    return expectedMatrix()(indices, Eigen::all);
+  }
+};
+
+// Some of the samples of a data set, by index. Splits and folds of a data set
+// are views of it, so they all share its buffers rather than copying them.
+struct DatasetView {
+  const Dataset *data = nullptr;
+  std::vector<Size> samples;
+
+  DatasetView() {}
+  DatasetView(const Dataset &data, std::vector<Size> samples)
+      : data(&data), samples(std::move(samples)) {}
+
+  Size size() const { return samples.size(); }
+  bool empty() const { return samples.empty(); }
+};
+
+// a data set that is read a chunk at a time, see Dataset.h
+class DataSource;
+
+// buffers kept by train() across all the chunks and epochs of a run
+struct TrainingState {
+  bool hogwild, batched;
+  // number of slices each batch (or chunk, for HOGWILD) is split into
+  Size workers;
+  // samples per slice of a batch
+  Size slice;
+
+  // the batches are laid out by the first chunk, as sparse inputs need no
+  // dense input layer (and no dense gradient for the first layer)
+  std::vector<BatchWorkspace> batches;
+  bool laid_out = false, sparse = false;
+  std::vector<Workspace> workspaces;
+  std::vector<Scalar> worker_errors;
+
+  // for loss sampling: the loss of every sample of the data set the last time
+  // it was trained on, and the weight its error is scaled by (both empty
+  // otherwise)
+  std::vector<Scalar> losses;
+  std::vector<Scalar> importance;
+  // loss of each sample trained on in the current chunk, in training order
+  std::vector<Scalar> visit_losses;
+};
 
 enum ActivationFunction {
   TANH,
@@ -39,17 +396,108 @@ enum ActivationFunction {
   NONE
 };
 
+enum TrainingMode {
+  // batches are split across threads and reduced before each weight update
+  SYNCHRONOUS,
+  // each thread trains on its own slice of the data, writing straight into the
+  // shared weights without locks (Hogwild!)
+  HOGWILD
+};
+
+enum ShuffleMode {
+  // every epoch walks the samples in file order
+  SHUFFLE_NONE,
+  // a new random order of all the samples every epoch
+  SHUFFLE_FULL,
+  // the samples are cut into contiguous blocks, the order of the blocks is
+  // shuffled, and then the order within each block. each block is read front
+  // to back in memory, which keeps big data sets cache and TLB friendly.
+  SHUFFLE_BLOCK
+};
+
+// Debug builds check that the training loops do not allocate, through a flag
+// Eigen shares between all threads. the check is on while any NoMallocScope is
+// alive (training opens one around its per-sample loops). does nothing in
+// release builds.
+struct NoMallocScope {
+  NoMallocScope();
+  ~NoMallocScope();
+
+  NoMallocScope(const NoMallocScope &) = delete;
+  NoMallocScope &operator=(const NoMallocScope &) = delete;
+};
+
+// threads that prepare data while training runs (and may allocate) hold one
+// of these, which pauses the check until the last of them is gone. so do the
+// batched paths while they lay out their buffers.
+struct AllocationCheckPause {
+  AllocationCheckPause();
+  ~AllocationCheckPause();
+
+  AllocationCheckPause(const AllocationCheckPause &) = delete;
+  AllocationCheckPause &operator=(const AllocationCheckPause &) = delete;
+};
+
+// transforms applied to the inputs on the fly, between a data set and
+// training (see Pipeline.h)
+struct TransformSpec {
+  // shift and scale every input column to zero mean and unit variance
+  bool standardize;
+  // standard deviation of gaussian noise added to every input (0 = none)
+  Scalar noise;
+  // clamp every input to [clip_min, clip_max], after the other transforms
+  bool clip;
+  Scalar clip_min, clip_max;
+  // threads applying the transforms
+  Size producers;
+
+  bool active() const { return standardize || noise > 0 || clip; }
+};
+
+enum SamplingMode {
+  // every sample once per epoch
+  SAMPLING_UNIFORM,
+  // after a first full epoch, samples are drawn (with replacement) with a
+  // probability that grows with their loss the last time they were trained
+  // on, and their error is scaled by 1 / (n p) so the gradient stays unbiased
+  SAMPLING_LOSS
+};
+
 struct Configuration {
   Scalar top_rate, bot_rate, decay_rate;
   Size cycle_length;
   ActivationFunction hidden_activation, output_activation;
+  // number of samples per weight update (1 = plain per-sample SGD)
+  Size batch_size;
+  // number of workers each batch (or, for HOGWILD, the data) is split across.
+  // 0 uses one per thread of the pool.
+  Size threads;
+  TrainingMode mode;
+  // order of the samples in each epoch. a streamed data set is only
+  // shuffled within each chunk.
+  ShuffleMode shuffle;
+  // samples per block for SHUFFLE_BLOCK
+  Size shuffle_block;
+  // the order of epoch e only depends on the seed and e
+  unsigned int seed;
+  // how samples are picked for each epoch. streamed data sets are always
+  // sampled uniformly.
+  SamplingMode sampling;
+  // for SAMPLING_LOSS, samples drawn per epoch, as a fraction of the data set
+  Scalar sample_fraction;
+  // input transforms, applied by the console when training
+  TransformSpec transforms;
 };
 
 class NeuralNetwork {
 public:
   // Initialise the neural network give topology and learning rate
   NeuralNetwork(Configuration c, Topology topology);
-  NeuralNetwork(Configuration c, Topology topology, NetworkWeights weights);
+  NeuralNetwork(Configuration c, Topology topology, NetworkWeights &weights);
+
+  // clone a network, weights included, with a single copy of its arena
+  NeuralNetwork(const NeuralNetwork &other);
+  NeuralNetwork &operator=(const NeuralNetwork &) = delete;
 
   // we need to add functions to read and write from disk.
   // (these will assume correctly formatted data so BE WARNED)
@@ -57,35 +505,184 @@ public:
   // Fill the network weights with pseudo-random numbers
   void randomWeights();
 
+  // run training and testing on the given pool (nullptr = single threaded)
+  void useThreadPool(ThreadPool *pool);
+
   // Generate the output values of each neuron and to vector array.
   // NOTE: Will assume that the input is of the right size.
-  Vector generate(Vector input);
+  // the result stays valid until the next call.
+  const VectorMap &generate(const VectorView &input);
+
+  // Thread-safe inference: any number of threads may run these at once on
+  // the same network, as long as it is not being trained meanwhile.
+
+  // generate, with buffers owned by the caller (see initialiseWorkspace).
+  // the result lives in the workspace.
+  const VectorMap &generate(Workspace &workspace,
+                            const VectorView &input) const;
+
+  // generate, with buffers owned by the calling thread. the result stays
+  // valid until the thread's next call.
+  const VectorMap &generateConcurrent(const VectorView &input) const;
+
+  // allocate single sample buffers for this topology in their own arena
+  void initialiseWorkspace(Workspace &workspace) const;
+
+  // whether a workspace was laid out for this topology
+  bool fits(const Workspace &workspace) const;
+
+  // generate for many samples at once, one per row of `inputs`, writing one
+  // output per row of `outputs`. samples go through each layer in batches
+  // (one matrix-matrix product per layer), spread over the thread pool.
+  void generateBatch(const Eigen::Ref<const RowMatrix> &inputs,
+                     Matrix &outputs) const;
+
+  // same, for sparse inputs. the first layer only reads the weights of the
+  // non-zero inputs.
+  void generateBatch(const SparseRowsMap &inputs, Matrix &outputs) const;
+
+  // number of samples per batch used by generateBatch, chosen so that a
+  // batch's activations stay in cache
+  Size inferenceBatchSize() const;
 
   // returns final error value
-  void train(TrainingData data, Size epochs, std::function<int(Size epoch, Scalar error, Scalar learning_rate)> trainStatisticHook);
+  void train(const Dataset &data, Size epochs,
+             std::function<int(Size epoch, Scalar error, Scalar learning_rate)>
+                 trainStatisticHook);
+
+  // same, reading the data from a source one chunk at a time, so that the
+  // data set never has to fit in memory.
+  void train(DataSource &source, Size epochs,
+             std::function<int(Size epoch, Scalar error, Scalar learning_rate)>
+                 trainStatisticHook);
+
+  // same, on the samples of a view only
+  void train(const DatasetView &data, Size epochs,
+             std::function<int(Size epoch, Scalar error, Scalar learning_rate)>
+                 trainStatisticHook);
+
+  // train several networks (e.g. one per cross validation fold) at once, each
+  // on its own view, sharing the pool of the first. every epoch runs the
+  // networks side by side, and the hook is called for each in turn after it.
+  static void trainTogether(
+      std::vector<NeuralNetwork> &networks,
+      const std::vector<DatasetView> &data, Size epochs,
+      std::function<int(Size network, Size epoch, Scalar error,
+                        Scalar learning_rate)>
+          trainStatisticHook);
 
   // test on a set of data, and return the average absolute error
-  Scalar test(TrainingData data, std::function<int(Vector input, Vector output, Scalar error)> testHook);
+  Scalar test(const Dataset &data,
+              std::function<int(const VectorView &input,
+                                const VectorView &output, Scalar error)>
+                  testHook);
+
+  // same, on the samples of a view only
+  Scalar test(const DatasetView &data,
+              std::function<int(const VectorView &input,
+                                const VectorView &output, Scalar error)>
+                  testHook);
 
   // weights (aka vector of matrices for matmul)
   NetworkWeights weights;
 
 private:
-  // update model weights with std. error.
-  void updateWeights(Scalar learning_rate);
+  // update model weights with std. error, from layer `first_layer` up.
+  void updateWeights(Workspace &workspace, Scalar learning_rate,
+                     Size first_layer = 0);
 
-  // train the network with an example
-  // returns error vector
-  Vector teach(Vector input, Vector expected, Scalar leanring_rate);
+  // update the rows of the first layer's weights read by one sparse sample
+  void updateSparseWeights(Workspace &workspace, const SparseRowsMap &inputs,
+                           Size sample, Scalar learning_rate);
 
-  // update error values based on expected result.
-  // returns error on output layer
-  void propogateError(Vector expected);
+  // generate from a sparse sample
+  void generateSparse(Workspace &workspace, const SparseRowsMap &inputs,
+                      Size sample) const;
 
-  void resetError();
+  // run the layers from `first_layer` up, from the neurons below them
+  void generateLayers(Workspace &workspace, Size first_layer) const;
 
+  // neuron values of a layer from its pre-activation
+  void activateLayer(Workspace &workspace, Size layer_index) const;
+
+  // train the network with one sample of a data set, with its error scaled
+  // by `weight`. returns the summed absolute (unweighted) error on the output
+  // layer
+  Scalar teach(Workspace &workspace, const Dataset &data, Size sample,
+               Scalar leanring_rate, Scalar weight = 1.0);
+
+  // update the error of the hidden layers, from that of the output layer.
+  void propogateError(Workspace &workspace);
+
+  void resetError(Workspace &workspace);
+
+  // lay out the weights and the default workspace in the network's arena
   void initialiseVectors();
 
+  // number of neurons in a layer, including its bias if it has one
+  Size layerSize(Size layer_index) const;
+
+  // number of arena scalars used by the weights, and by a workspace
+  Size weightsSize() const;
+  Size workspaceSize() const;
+
+  // carve single sample buffers for this topology out of `arena`
+  void layoutWorkspace(Workspace &workspace, NetworkArena &arena) const;
+
+  // allocate batch buffers able to hold `capacity` samples. inference only
+  // needs the forward buffers (neurons and preActivation), so without
+  // `training` the error, expected output and gradient buffers are left out.
+  // for `sparse` inputs, the dense input layer and first layer gradient are
+  // left out as well. any earlier layout of the batch is dropped.
+  void initialiseBatch(BatchWorkspace &batch, Size capacity,
+                       bool training = true, bool sparse = false) const;
+
+  // copy `rows` samples starting at `first` into the batch buffers. with
+  // `samples`, `first` indexes into them instead of the data set.
+  void loadBatch(BatchWorkspace &batch, const Dataset &data, Size first,
+                 Size rows, const std::vector<Size> *samples = nullptr);
+
+  // forward pass over the first `rows` samples of the batch
+  void generateBatch(BatchWorkspace &batch, Size rows) const;
+
+  // forward pass over `samples` samples in cache sized batches on the pool,
+  // with load(batch, first, rows) filling each batch's inputs (the sparse
+  // inputs, if `sparse`)
+  void generateBatches(
+      Size samples, Matrix &outputs, bool sparse,
+      std::function<void(BatchWorkspace &batch, Size first, Size rows)> load)
+      const;
+
+  // backward pass over the first `rows` samples of the batch. returns the
+  // summed absolute (unweighted) error on the output layer.
+  Scalar propogateBatchError(BatchWorkspace &batch, Size rows);
+
+  // run the forward and backward pass and sum the weight gradient over the
+  // batch. returns the summed absolute error on the output layer.
+  Scalar computeBatchGradient(BatchWorkspace &batch, Size rows);
+
+  // apply the gradient of the layers from `first_layer` up
+  void applyGradient(NetworkWeights &gradient, Scalar learning_rate,
+                     Size first_layer = 0);
+
+  // apply the first layer's gradient over the rows a sparse batch touched
+  void applySparseGradient(BatchWorkspace &batch, Scalar learning_rate);
+
+  // set up the buffers for a training run
+  void initialiseTraining(TrainingState &state);
+
+  // train on every sample of `data` (or just on `samples`, in that order)
+  // once, returns the summed absolute error
+  Scalar trainChunk(TrainingState &state, const Dataset &data,
+                    Scalar learning_rate,
+                    const std::vector<Size> *samples = nullptr);
+
+  // test on every sample of `data`, or just on `samples`
+  Scalar testSamples(const Dataset &data, const std::vector<Size> *samples,
+                     std::function<int(const VectorView &input,
+                                       const VectorView &output, Scalar error)>
+                         testHook);
+
 
   
   // sigmoid activation function 
@@ -96,15 +693,16 @@ private:
   
   Topology topology;
 
-  // pre-activation function value for each layer's neurons
-  NetworkData preActivation;
-  // post-activation function (true) value for each layer's neurons
-  NetworkData neurons;
-  // calculated error for each layer's neurons
-  NetworkData error;
+  // holds the weights followed by the default workspace
+  NetworkArena arena;
+
+  // buffers used by the single threaded paths
+  Workspace workspace;
 
   Configuration config;
 
+  ThreadPool *pool;
+
 };
 
 Scalar smooth(Scalar x);
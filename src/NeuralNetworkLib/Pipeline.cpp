@@ -0,0 +1,304 @@
+#include "Pipeline.h"
+
+#include <chrono>
+
+ColumnStatistics computeColumnStatistics(DataSource &source) {
+  ColumnStatistics statistics;
+
+  // accumulated in doubles, so long passes do not lose precision
+  Eigen::RowVectorXd mean, squares;
+
+  Dataset chunk;
+
+  source.rewind();
+
+  while (source.next(chunk)) {
+    Eigen::MatrixXd inputs = chunk.sparse()
+                                 ? chunk.denseInputs().cast<double>().eval()
+                                 : chunk.inputs.cast<double>().eval();
+
+    // the chunk's own mean and sum of squared deviations...
+    uint64_t rows = inputs.rows();
+    Eigen::RowVectorXd chunk_mean = inputs.colwise().mean();
+    Eigen::RowVectorXd chunk_squares =
+        (inputs.rowwise() - chunk_mean).array().square().colwise().sum();
+
+    if (statistics.count == 0) {
+      mean = chunk_mean;
+      squares = chunk_squares;
+      statistics.count = rows;
+      continue;
+    }
+
+    // ...merged into the running ones (Chan et al.'s pairwise update)
+    uint64_t count = statistics.count + rows;
+    Eigen::RowVectorXd delta = chunk_mean - mean;
+
+    mean += delta * ((double)rows / count);
+    squares += chunk_squares + delta.array().square().matrix() *
+                                   ((double)statistics.count * rows / count);
+    statistics.count = count;
+  }
+
+  if (statistics.count > 0) {
+    statistics.mean = mean.cast<Scalar>();
+    statistics.deviation =
+        (squares / statistics.count).array().sqrt().matrix().cast<Scalar>();
+  }
+
+  return statistics;
+}
+
+void transformInputs(const TransformSpec &spec,
+                     const ColumnStatistics &statistics, Dataset &chunk,
+                     std::mt19937 *generator) {
+  // standardized inputs are no longer mostly zero (nor on the grid of their
+  // encoding), and a shared data set is read-only, so in all these cases the
+  // inputs are copied into a dense matrix
+  if (chunk.sparse() || chunk.isShared() || chunk.isEncoded()) {
+    RowMatrix dense = chunk.denseInputs();
+
+    if (chunk.isShared()) {
+      if (chunk.labelled())
+        chunk.labels.assign(chunk.labelData(),
+                            chunk.labelData() + chunk.size());
+      else
+        chunk.expected = chunk.expectedMatrix();
+      chunk.shared = SharedSamples();
+    }
+
+    chunk.inputs = std::move(dense);
+    chunk.sparse_inputs = SparseRows();
+    chunk.encoded = EncodedInputs();
+  }
+
+  if (spec.standardize && !statistics.empty()) {
+    chunk.inputs.rowwise() -= statistics.mean;
+
+    // constant columns are only centred
+    Vector scale = statistics.deviation.unaryExpr(
+        [](Scalar deviation) -> Scalar {
+          return deviation > 0 ? 1 / deviation : 1;
+        });
+    chunk.inputs.array().rowwise() *= scale.array();
+  }
+
+  if (spec.noise > 0 && generator != nullptr) {
+    std::normal_distribution<Scalar> normal(0.0, spec.noise);
+
+    for (Eigen::Index index = 0; index < chunk.inputs.size(); index++)
+      chunk.inputs.data()[index] += normal(*generator);
+  }
+
+  if (spec.clip)
+    chunk.inputs =
+        chunk.inputs.cwiseMax(spec.clip_min).cwiseMin(spec.clip_max);
+}
+
+TransformSource::TransformSource(DataSource &upstream,
+                                 const TransformSpec &spec,
+                                 const ColumnStatistics &statistics,
+                                 ThreadPool &pool, unsigned int seed,
+                                 Size prefetch)
+    : upstream(upstream), spec(spec), statistics(statistics), seed(seed),
+      producers(&pool), passes(0), active(0), quitting(false), epoch(0) {
+  Size count = std::max<Size>(1, spec.producers);
+
+  for (Size producer = 0; producer < count; producer++)
+    rings.push_back(std::make_unique<RingBuffer<Dataset>>(
+        std::max<Size>(1, prefetch)));
+
+  finished = std::make_unique<std::atomic<bool>[]>(count);
+
+  upstream.rewind();
+  start();
+}
+
+TransformSource::~TransformSource() {
+  stop();
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    quitting = true;
+  }
+  turn_changed.notify_all();
+
+  producers.wait();
+}
+
+void TransformSource::start() {
+  // every producer is between passes, so nothing else touches the rings
+  for (Size producer = 0; producer < rings.size(); producer++) {
+    rings[producer]->clear();
+    finished[producer] = false;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    next_chunk = 0;
+    upstream_done = false;
+    failure = nullptr;
+    stopping = false;
+    taken = 0;
+    fresh = true;
+
+    passes++;
+    active = rings.size();
+  }
+
+  if (passes == 1) {
+    for (Size producer = 0; producer < rings.size(); producer++)
+      producers.runBlocking([this, producer] { run(producer); });
+  } else {
+    turn_changed.notify_all();
+  }
+}
+
+void TransformSource::stop() {
+  std::unique_lock<std::mutex> lock(mutex);
+
+  stopping = true;
+  turn_changed.notify_all();
+
+  // the producers stay, for the next pass
+  turn_changed.wait(lock, [this] { return active == 0; });
+}
+
+void TransformSource::run(Size producer) {
+  Size pass = 0;
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      turn_changed.wait(lock, [&] { return quitting || passes != pass; });
+
+      if (quitting)
+        return;
+
+      pass = passes;
+    }
+
+    produce(producer);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      active--;
+    }
+    turn_changed.notify_all();
+  }
+}
+
+void TransformSource::rewind() {
+  // still at the first chunk, no need to start over
+  if (fresh)
+    return;
+
+  stop();
+  upstream.rewind();
+  epoch++;
+  start();
+}
+
+void TransformSource::produce(Size producer) {
+  // chunks are reshaped and transformed while training runs
+  AllocationCheckPause pause;
+
+  RingBuffer<Dataset> &ring = *rings[producer];
+  Size count = rings.size();
+
+  while (!stopping) {
+    Dataset *slot = ring.back();
+
+    if (slot == nullptr) {
+      // the consumer has not caught up yet
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+      continue;
+    }
+
+    Size index;
+
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+
+      turn_changed.wait(lock, [&] {
+        return stopping || upstream_done || next_chunk % count == producer;
+      });
+
+      if (stopping || upstream_done)
+        break;
+
+      bool more = false;
+
+      try {
+        more = upstream.next(*slot);
+      } catch (...) {
+        failure = std::current_exception();
+      }
+
+      index = next_chunk++;
+      upstream_done = !more;
+
+      lock.unlock();
+      turn_changed.notify_all();
+
+      if (!more)
+        break;
+    }
+
+    // the slow part, outside the lock and in parallel with the others
+    if (spec.noise > 0) {
+      std::seed_seq chunk_seed{seed, epoch, index};
+      std::mt19937 generator(chunk_seed);
+      transformInputs(spec, statistics, *slot, &generator);
+    } else {
+      transformInputs(spec, statistics, *slot);
+    }
+
+    ring.push();
+  }
+
+  finished[producer].store(true, std::memory_order_release);
+}
+
+bool TransformSource::next(Dataset &chunk) {
+  fresh = false;
+
+  Size producer = taken % rings.size();
+  RingBuffer<Dataset> &ring = *rings[producer];
+
+  Dataset *slot;
+  Size spins = 0;
+
+  while ((slot = ring.front()) == nullptr) {
+    if (finished[producer].load(std::memory_order_acquire)) {
+      // it may have pushed one last chunk before finishing
+      if ((slot = ring.front()) != nullptr)
+        break;
+
+      chunk.resize(0);
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if (failure) {
+        std::exception_ptr rethrown = failure;
+        failure = nullptr;
+        std::rethrow_exception(rethrown);
+      }
+
+      return false;
+    }
+
+    // a short spin, the chunk is usually nearly done
+    if (++spins < 64)
+      std::this_thread::yield();
+    else
+      std::this_thread::sleep_for(std::chrono::microseconds(20));
+  }
+
+  // hand our spent buffers back through the ring
+  std::swap(chunk, *slot);
+  ring.pop();
+  taken++;
+
+  return true;
+}
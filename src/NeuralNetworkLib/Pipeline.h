@@ -0,0 +1,153 @@
+#ifndef PIPELINE_H
+
+#include "Dataset.h"
+#include "NeuralNetwork.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+// Single producer, single consumer ring buffer of reusable slots. the producer
+// fills the slot at back() in place and push()es it, the consumer takes the
+// slot at front() (typically swapping its own spent buffers into it) and
+// pop()s it, so buffers go round the ring without being reallocated. neither
+// side ever takes a lock.
+template <typename T> class RingBuffer {
+public:
+  RingBuffer(std::size_t capacity) : slots(capacity + 1), head(0), tail(0) {}
+
+  // the next slot to fill, or nullptr if the ring is full
+  T *back() {
+    std::size_t current = tail.load(std::memory_order_relaxed);
+    if ((current + 1) % slots.size() == head.load(std::memory_order_acquire))
+      return nullptr;
+    return &slots[current];
+  }
+
+  void push() {
+    tail.store((tail.load(std::memory_order_relaxed) + 1) % slots.size(),
+               std::memory_order_release);
+  }
+
+  // the oldest filled slot, or nullptr if the ring is empty
+  T *front() {
+    std::size_t current = head.load(std::memory_order_relaxed);
+    if (current == tail.load(std::memory_order_acquire))
+      return nullptr;
+    return &slots[current];
+  }
+
+  void pop() {
+    head.store((head.load(std::memory_order_relaxed) + 1) % slots.size(),
+               std::memory_order_release);
+  }
+
+  // only while neither side is running
+  void clear() {
+    head = 0;
+    tail = 0;
+  }
+
+private:
+  std::vector<T> slots;
+  // kept on their own cache lines, so the two sides do not false share
+  alignas(64) std::atomic<std::size_t> head;
+  alignas(64) std::atomic<std::size_t> tail;
+};
+
+// Mean and standard deviation of every input column.
+struct ColumnStatistics {
+  Vector mean;
+  Vector deviation;
+  uint64_t count = 0;
+
+  bool empty() const { return count == 0; }
+};
+
+// one streaming pass over a source, merging the (Welford) statistics of each
+// chunk. the source is left at its end.
+ColumnStatistics computeColumnStatistics(DataSource &source);
+
+// apply the transforms of `spec` to the inputs of a chunk (which become
+// dense, and are copied out of a shared data set). `statistics` is needed to
+// standardize, and noise is only added with a `generator`.
+void transformInputs(const TransformSpec &spec,
+                     const ColumnStatistics &statistics, Dataset &chunk,
+                     std::mt19937 *generator = nullptr);
+
+// Applies input transforms to the chunks of another source on producer threads.
+//
+// Chunk k of the upstream source is read and transformed by producer
+// k % producers, which hands it to the consumer through its own ring buffer.
+// the consumer reads the rings in the same turn, so chunks come out in their
+// upstream order, and the noise of each chunk only depends on the seed, the
+// epoch and k, whatever the number of producers. transforms run while the
+// consumer trains on earlier chunks, with up to `prefetch` chunks ready per
+// producer. The producers run on the I/O lane of `pool` for as long as the
+// source lives, and start a new pass on every rewind().
+class TransformSource : public DataSource {
+public:
+  TransformSource(DataSource &upstream, const TransformSpec &spec,
+                  const ColumnStatistics &statistics, ThreadPool &pool,
+                  unsigned int seed = 0, Size prefetch = 2);
+  ~TransformSource();
+
+  TransformSource(const TransformSource &) = delete;
+  TransformSource &operator=(const TransformSource &) = delete;
+
+  void rewind() override;
+  bool next(Dataset &chunk) override;
+
+private:
+  // body of producer task `producer`, one produce() per pass
+  void run(Size producer);
+  // transform the producer's turns of the upstream chunks, until the end of
+  // the upstream source or until stopped
+  void produce(Size producer);
+
+  void start();
+  void stop();
+
+  DataSource &upstream;
+  TransformSpec spec;
+  ColumnStatistics statistics;
+  unsigned int seed;
+
+  std::vector<std::unique_ptr<RingBuffer<Dataset>>> rings;
+  TaskGroup producers;
+  // set by each producer once it will push nothing more
+  std::unique_ptr<std::atomic<bool>[]> finished;
+
+  // producers take turns reading the upstream source
+  std::mutex mutex;
+  std::condition_variable turn_changed;
+  Size next_chunk;
+  bool upstream_done;
+  std::exception_ptr failure;
+
+  std::atomic<bool> stopping;
+  // passes started, the producers still in the current one, and whether the
+  // producer tasks have been asked to exit
+  Size passes;
+  Size active;
+  bool quitting;
+
+  // next chunk the consumer takes
+  Size taken;
+  // number of times the source was rewound, for the noise
+  Size epoch;
+  // nothing has been taken since the producers started
+  bool fresh;
+};
+
+#endif
+
+#define PIPELINE_H
@@ -0,0 +1,253 @@
+#include "SharedDataset.h"
+
+#include <atomic>
+#include <cstring>
+#include <optional>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// blocks start on a cache line
+static uint64_t alignOffset(uint64_t offset) { return (offset + 63) & ~63ULL; }
+
+// the name of the segment in the shm namespace, or "" if `name` is not valid
+static std::string segmentName(std::string name) {
+  if (name.empty() || name.size() > 200 ||
+      name.find('/') != std::string::npos)
+    return "";
+
+  return "/" + name;
+}
+
+bool publishSharedDataset(std::string name, const Dataset &data) {
+  std::string segment = segmentName(name);
+
+  if (segment.empty())
+    return false;
+
+  SharedDatasetHeader header = {};
+
+  header.version = SHARED_DATASET_VERSION;
+  header.samples = data.size();
+  header.input_size = data.inputSize();
+  header.output_size = data.outputSize();
+  header.classes = data.classes;
+  header.sparse = data.sparse();
+
+  // the CSR arrays are copied as they are, so they have to be compressed
+  std::optional<SparseRows> compressed;
+  if (data.sparse() && !data.sparseInputs().isCompressed())
+    compressed.emplace(data.sparseInputs());
+
+  SparseRowsMap csr = compressed ? SparseRowsMap(compressed->rows(),
+                                                 compressed->cols(),
+                                                 compressed->nonZeros(),
+                                                 compressed->outerIndexPtr(),
+                                                 compressed->innerIndexPtr(),
+                                                 compressed->valuePtr())
+                                 : data.sparseInputs();
+
+  // the segment holds floats, so encoded inputs are widened into it
+  RowMatrix decoded;
+  if (data.isEncoded())
+    decoded = data.denseInputs();
+  RowsMap inputs = data.isEncoded() ? RowsMap(decoded.data(), decoded.rows(),
+                                              decoded.cols())
+                                    : data.inputMatrix();
+
+  uint64_t offset = alignOffset(sizeof(header));
+
+  auto place = [&](uint64_t &block_offset, uint64_t bytes) {
+    block_offset = offset;
+    offset = alignOffset(offset + bytes);
+  };
+
+  if (header.sparse) {
+    header.nonzeros = csr.nonZeros();
+    place(header.outer_offset, (header.samples + 1) * sizeof(int));
+    place(header.inner_offset, header.nonzeros * sizeof(int));
+    place(header.values_offset, header.nonzeros * sizeof(Scalar));
+  } else {
+    place(header.inputs_offset,
+          header.samples * header.input_size * sizeof(Scalar));
+  }
+
+  if (header.classes > 0)
+    place(header.labels_offset, header.samples * sizeof(Size));
+  else
+    place(header.expected_offset,
+          header.samples * header.output_size * sizeof(Scalar));
+
+  header.size = offset;
+
+  // never replaces a segment someone may be attached to
+  int file = shm_open(segment.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+
+  if (file < 0)
+    return false;
+
+  void *address = MAP_FAILED;
+
+  if (ftruncate(file, header.size) == 0)
+    address = mmap(nullptr, header.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   file, 0);
+
+  close(file);
+
+  if (address == MAP_FAILED) {
+    shm_unlink(segment.c_str());
+    return false;
+  }
+
+  char *base = (char *)address;
+
+  auto copy = [&](uint64_t block_offset, const void *source, uint64_t bytes) {
+    if (bytes > 0)
+      std::memcpy(base + block_offset, source, bytes);
+  };
+
+  if (header.sparse) {
+    copy(header.outer_offset, csr.outerIndexPtr(),
+         (header.samples + 1) * sizeof(int));
+    copy(header.inner_offset, csr.innerIndexPtr(),
+         header.nonzeros * sizeof(int));
+    copy(header.values_offset, csr.valuePtr(),
+         header.nonzeros * sizeof(Scalar));
+  } else {
+    copy(header.inputs_offset, inputs.data(),
+         header.samples * header.input_size * sizeof(Scalar));
+  }
+
+  if (header.classes > 0)
+    copy(header.labels_offset, data.labelData(),
+         header.samples * sizeof(Size));
+  else
+    copy(header.expected_offset, data.expectedMatrix().data(),
+         header.samples * header.output_size * sizeof(Scalar));
+
+  // everything else first, the magic marks the segment as complete
+  std::memcpy(base, &header, sizeof(header));
+  std::atomic_thread_fence(std::memory_order_release);
+  std::memcpy(base, SHARED_DATASET_MAGIC, sizeof(header.magic));
+
+  munmap(address, header.size);
+
+  return true;
+}
+
+Dataset attachSharedDataset(std::string name, Topology topology) {
+  Dataset data(topology.front(), topology.back());
+
+  std::string segment = segmentName(name);
+
+  if (segment.empty())
+    return data;
+
+  int file = shm_open(segment.c_str(), O_RDONLY, 0);
+
+  if (file < 0)
+    return data;
+
+  struct stat status;
+  void *address = MAP_FAILED;
+  size_t length = 0;
+
+  if (fstat(file, &status) == 0 &&
+      (size_t)status.st_size >= sizeof(SharedDatasetHeader)) {
+    length = status.st_size;
+    address = mmap(nullptr, length, PROT_READ, MAP_SHARED, file, 0);
+  }
+
+  // the mapping holds on to the segment by itself
+  close(file);
+
+  if (address == MAP_FAILED)
+    return data;
+
+  std::shared_ptr<const void> mapping(
+      address, [length](const void *mapped) { munmap((void *)mapped, length); });
+
+  const char *base = (const char *)address;
+
+  SharedDatasetHeader header;
+  std::memcpy(&header, base, sizeof(header));
+  std::atomic_thread_fence(std::memory_order_acquire);
+
+  if (std::memcmp(header.magic, SHARED_DATASET_MAGIC, sizeof(header.magic)) !=
+          0 ||
+      header.version != SHARED_DATASET_VERSION || header.size > length)
+    return data;
+
+  if (header.input_size != topology.front() ||
+      header.output_size != topology.back())
+    return data;
+
+  // every block has to lie within the segment
+  auto fits = [&](uint64_t block_offset, uint64_t bytes) {
+    return block_offset >= sizeof(header) && block_offset <= header.size &&
+           bytes <= header.size - block_offset;
+  };
+
+  bool valid;
+
+  if (header.sparse)
+    valid = fits(header.outer_offset, (header.samples + 1) * sizeof(int)) &&
+            fits(header.inner_offset, header.nonzeros * sizeof(int)) &&
+            fits(header.values_offset, header.nonzeros * sizeof(Scalar));
+  else
+    valid = fits(header.inputs_offset,
+                 header.samples * header.input_size * sizeof(Scalar));
+
+  if (header.classes > 0)
+    valid = valid && header.classes == header.output_size &&
+            fits(header.labels_offset, header.samples * sizeof(Size));
+  else
+    valid = valid && fits(header.expected_offset, header.samples *
+                                                      header.output_size *
+                                                      sizeof(Scalar));
+
+  if (!valid)
+    return data;
+
+  SharedSamples &shared = data.shared;
+
+  shared.samples = header.samples;
+
+  if (header.sparse) {
+    shared.sparse_columns = header.input_size;
+    shared.nonzeros = header.nonzeros;
+    shared.outer = (const int *)(base + header.outer_offset);
+    shared.inner = (const int *)(base + header.inner_offset);
+    shared.values = (const Scalar *)(base + header.values_offset);
+
+    // the row pointers have to end at the number of values
+    if ((uint64_t)shared.outer[header.samples] != header.nonzeros)
+      return Dataset(topology.front(), topology.back());
+  } else {
+    shared.input_columns = header.input_size;
+    shared.inputs = (const Scalar *)(base + header.inputs_offset);
+  }
+
+  if (header.classes > 0) {
+    shared.labels = (const Size *)(base + header.labels_offset);
+  } else {
+    shared.expected_columns = header.output_size;
+    shared.expected = (const Scalar *)(base + header.expected_offset);
+  }
+
+  // the matrices of the data set itself hold nothing
+  data.inputs.resize(0, 0);
+  data.expected.resize(0, 0);
+  data.classes = header.classes;
+  shared.mapping = std::move(mapping);
+
+  return data;
+}
+
+bool unpublishSharedDataset(std::string name) {
+  std::string segment = segmentName(name);
+
+  return !segment.empty() && shm_unlink(segment.c_str()) == 0;
+}
@@ -0,0 +1,61 @@
+#ifndef SHARED_DATASET_H
+
+#include "NeuralNetwork.h"
+
+#include <cstdint>
+#include <string>
+
+// Data sets shared between processes.
+//
+// A parsed data set can be published into a named POSIX shared memory segment
+// (under /dev/shm on Linux), which other processes attach to read-only: every
+// process training on it maps the same pages, so N jobs hold one copy of the
+// data rather than N, and attaching costs no parsing or copying at all.
+//
+// The segment is a header followed by the data set's blocks as they are kept
+// in memory: dense inputs (or the three CSR arrays of sparse inputs), then
+// the expected outputs (or the labels). every block starts on a 64 byte
+// boundary. The magic is written last, so a segment that is still being
+// filled is never attached to.
+
+static const char SHARED_DATASET_MAGIC[4] = {'N', 'N', 'S', 'M'};
+static const uint32_t SHARED_DATASET_VERSION = 1;
+
+struct SharedDatasetHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t samples;
+  uint32_t input_size;
+  uint32_t output_size;
+  // number of classes, 0 unless labelled
+  uint32_t classes;
+  // 1 if the inputs are stored as CSR
+  uint32_t sparse;
+  uint64_t nonzeros;
+  // byte offsets of the blocks from the start of the segment (0 = absent)
+  uint64_t inputs_offset;
+  uint64_t expected_offset;
+  uint64_t labels_offset;
+  uint64_t outer_offset;
+  uint64_t inner_offset;
+  uint64_t values_offset;
+  // size of the whole segment
+  uint64_t size;
+};
+
+// publish a data set as segment `name`. returns false if the name is not
+// valid, a segment of that name already exists, or it could not be created
+// and filled.
+bool publishSharedDataset(std::string name, const Dataset &data);
+
+// map segment `name` read-only. returns no samples if there is no such
+// segment, it is not a valid data set, or it does not fit the topology.
+Dataset attachSharedDataset(std::string name, Topology topology);
+
+// remove segment `name`. processes attached to it keep their mapping until
+// they drop it. returns false if there is no such segment.
+bool unpublishSharedDataset(std::string name);
+
+#endif
+
+#define SHARED_DATASET_H
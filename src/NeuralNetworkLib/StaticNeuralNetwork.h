@@ -0,0 +1,206 @@
+#ifndef STATICNEURALNETWORK_H
+
+#include "NetworkReflection.h"
+#include "NeuralNetwork.h"
+#include "maths.h"
+
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+
+// A neural network whose topology and activation functions are fixed at
+// compile time, e.g.
+//
+//   StaticNeuralNetwork<TANH, BINARY, 2, 3, 3, 3, 1> xor_network;
+//
+// Every buffer is a fixed-size Eigen type held inline, so there are no heap
+// allocations or runtime size checks, and Eigen can fully unroll and vectorise
+// the products of small networks. The layout of the weights is the same as
+// for NeuralNetwork, so both classes read and write the same network folders.
+template <ActivationFunction HiddenActivation,
+          ActivationFunction OutputActivation, int... Sizes>
+class StaticNeuralNetwork {
+public:
+  static constexpr std::size_t num_layers = sizeof...(Sizes);
+  static constexpr std::array<int, num_layers> sizes = {Sizes...};
+
+  static_assert(num_layers >= 2, "A network needs at least two layers");
+
+  // neurons of a layer, with a trailing bias on all but the output layer
+  template <std::size_t L>
+  using Layer =
+      Eigen::Matrix<Scalar, 1, sizes[L] + (L + 1 < num_layers ? 1 : 0)>;
+
+  // error of a layer (no bias)
+  template <std::size_t L> using LayerError = Eigen::Matrix<Scalar, 1, sizes[L]>;
+
+  // weights from layer L (bias included) to layer L + 1
+  template <std::size_t L>
+  using LayerWeights = Eigen::Matrix<Scalar, sizes[L] + 1, sizes[L + 1]>;
+
+  typedef Eigen::Matrix<Scalar, 1, sizes[0]> Input;
+  typedef Layer<num_layers - 1> Output;
+
+  StaticNeuralNetwork() {
+    setBiases(std::make_index_sequence<num_layers - 1>());
+    randomWeights();
+  }
+
+  // check whether a topology read from disk describes this network
+  static bool matches(const Topology &topology) {
+    if (topology.size() != num_layers)
+      return false;
+
+    for (std::size_t layer_index = 0; layer_index < num_layers; layer_index++)
+      if ((int)topology[layer_index] != sizes[layer_index])
+        return false;
+
+    return true;
+  }
+
+  // Fill the network weights with pseudo-random numbers
+  void randomWeights() {
+    std::apply([](auto &...layer_weights) { (layer_weights.setRandom(), ...); },
+               weights);
+  }
+
+  // Generate the output values of each neuron, and return the output layer.
+  const Output &generate(const Input &input) {
+    std::get<0>(neurons).template head<sizes[0]>() = input;
+
+    forward<1>();
+
+    return std::get<num_layers - 1>(neurons);
+  }
+
+  // train the network with an example, returns the summed absolute error on
+  // the output layer.
+  Scalar teach(const Input &input, const Output &expected,
+               Scalar learning_rate) {
+    generate(input);
+
+    std::get<num_layers - 1>(errors) =
+        std::get<num_layers - 1>(neurons) - expected;
+
+    if constexpr (num_layers > 2)
+      backward<num_layers - 2>();
+
+    update(learning_rate, std::make_index_sequence<num_layers - 1>());
+
+    return std::get<num_layers - 1>(errors).cwiseAbs().sum();
+  }
+
+  // copy weights from (or to) a dynamic network of the same topology
+  void copyWeights(const NetworkWeights &network_weights) {
+    copyWeights(network_weights, std::make_index_sequence<num_layers - 1>());
+  }
+
+  void storeWeights(NetworkWeights &network_weights) const {
+    storeWeights(network_weights, std::make_index_sequence<num_layers - 1>());
+  }
+
+  // load topology.txt, config.txt and weights.bin from a network folder.
+  // returns false if the folder does not describe this network.
+  bool load(std::string folder_name) {
+    Topology topology = readTopology(folder_name + "/topology.txt");
+    Configuration config;
+
+    try {
+      config = readConfiguration(folder_name + "/config.txt");
+    } catch (const std::runtime_error &) {
+      return false;
+    }
+
+    if (!matches(topology) || config.hidden_activation != HiddenActivation ||
+        config.output_activation != OutputActivation)
+      return false;
+
+    NeuralNetwork network(config, topology);
+
+    if (!readWeights(folder_name + "/weights.bin", network.weights))
+      return false;
+
+    copyWeights(network.weights);
+
+    return true;
+  }
+
+private:
+  template <typename Sequence> struct Buffers;
+
+  template <std::size_t... L> struct Buffers<std::index_sequence<L...>> {
+    typedef std::tuple<Layer<L>...> Neurons;
+    typedef std::tuple<LayerError<L>...> Errors;
+  };
+
+  template <typename Sequence> struct WeightBuffers;
+
+  template <std::size_t... L> struct WeightBuffers<std::index_sequence<L...>> {
+    typedef std::tuple<LayerWeights<L>...> Weights;
+  };
+
+  template <std::size_t... L> void setBiases(std::index_sequence<L...>) {
+    // Bias coefficient is 1 always!!!
+    ((std::get<L>(neurons)(sizes[L]) = 1.0), ...);
+  }
+
+  template <std::size_t L> void forward() {
+    constexpr ActivationFunction activation =
+        L + 1 < num_layers ? HiddenActivation : OutputActivation;
+
+    LayerError<L> preActivation =
+        std::get<L - 1>(neurons) * std::get<L - 1>(weights);
+
+    std::get<L>(neurons).template head<sizes[L]>() =
+        activate<activation>(preActivation.array()).matrix();
+
+    if constexpr (L + 1 < num_layers)
+      forward<L + 1>();
+  }
+
+  // error of hidden layer L from the error of the layer above it
+  template <std::size_t L> void backward() {
+    std::get<L>(errors) =
+        (std::get<L + 1>(errors) *
+         std::get<L>(weights).template topRows<sizes[L]>().transpose())
+            .cwiseProduct(
+                activateDerivative<HiddenActivation>(
+                    std::get<L>(neurons).template head<sizes[L]>().array())
+                    .matrix());
+
+    if constexpr (L > 1)
+      backward<L - 1>();
+  }
+
+  template <std::size_t... L>
+  void update(Scalar learning_rate, std::index_sequence<L...>) {
+    ((std::get<L>(weights).noalias() -=
+      learning_rate * std::get<L>(neurons).transpose() *
+      std::get<L + 1>(errors)),
+     ...);
+  }
+
+  template <std::size_t... L>
+  void copyWeights(const NetworkWeights &network_weights,
+                   std::index_sequence<L...>) {
+    ((std::get<L>(weights) = network_weights[L]), ...);
+  }
+
+  template <std::size_t... L>
+  void storeWeights(NetworkWeights &network_weights,
+                    std::index_sequence<L...>) const {
+    ((network_weights[L] = std::get<L>(weights)), ...);
+  }
+
+  typename WeightBuffers<std::make_index_sequence<num_layers - 1>>::Weights
+      weights;
+  typename Buffers<std::make_index_sequence<num_layers>>::Neurons neurons;
+  typename Buffers<std::make_index_sequence<num_layers>>::Errors errors;
+};
+
+#endif
+
+#define STATICNEURALNETWORK_H
@@ -0,0 +1,217 @@
+#include "Synthetic.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// samples written per chunk when generating a file
+static const Size WRITE_CHUNK = 1 << 16;
+
+// smallest slice of a chunk worth a task of its own
+static const Size MIN_TASK_SAMPLES = 1024;
+
+// splitmix64's finaliser, a cheap hash with good avalanche
+static uint64_t mix(uint64_t key) {
+  key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+  return key ^ (key >> 31);
+}
+
+// a value in [-1, 1) for a position of a stream, exact in a float
+static Scalar uniform(uint64_t seed, uint64_t position) {
+  uint64_t bits = mix(seed + mix(position + 0x9e3779b97f4a7c15ULL)) >> 40;
+  return (Scalar)bits * (2.0f / (1 << 24)) - 1.0f;
+}
+
+SyntheticGenerator::SyntheticGenerator(SyntheticTask task, Size input_size,
+                                       Size output_size, uint64_t seed)
+    : task(task), input_size(input_size), output_size(output_size),
+      seed(seed) {
+  if (task != SYNTHETIC_CLASSIFICATION)
+    return;
+
+  // the projections have a stream of their own, apart from the inputs
+  uint64_t projection_seed = mix(seed ^ 0x636c617373657321ULL);
+
+  projections.resize(output_size, input_size);
+
+  for (Size label = 0; label < output_size; label++)
+    for (Size input = 0; input < input_size; input++)
+      projections(label, input) =
+          uniform(projection_seed, (uint64_t)label * input_size + input);
+}
+
+Dataset SyntheticGenerator::emptyChunk() const {
+  if (task == SYNTHETIC_CLASSIFICATION) {
+    Dataset chunk(input_size, 0);
+    chunk.classes = output_size;
+    return chunk;
+  }
+
+  return Dataset(input_size, output_size);
+}
+
+void SyntheticGenerator::generate(uint64_t first, Size rows, Dataset &chunk,
+                                  Size row) const {
+  for (Size index = 0; index < rows; index++) {
+    uint64_t sample = first + index;
+    auto input = chunk.inputs.row(row + index);
+
+    for (Size column = 0; column < input_size; column++)
+      input(column) = uniform(seed, sample * input_size + column);
+
+    if (task == SYNTHETIC_CLASSIFICATION) {
+      Size label = 0;
+      Scalar best = projections.row(0).dot(input);
+
+      for (Size other = 1; other < output_size; other++) {
+        Scalar score = projections.row(other).dot(input);
+        if (score > best) {
+          best = score;
+          label = other;
+        }
+      }
+
+      chunk.labels[row + index] = label;
+      continue;
+    }
+
+    // x0 - x1 + x2 - ...
+    Scalar sum = 0.0;
+    for (Size column = 0; column < input_size; column++)
+      sum += column % 2 ? -input(column) : input(column);
+
+    for (Size output = 0; output < output_size; output++)
+      chunk.expected(row + index, output) =
+          std::sin(output % 2 ? -sum : sum);
+  }
+}
+
+void SyntheticGenerator::generateChunk(uint64_t first, Size rows,
+                                       Dataset &chunk,
+                                       ThreadPool *pool) const {
+  // reuse the chunk's buffers if it already has the right shape
+  if (chunk.sparse() || chunk.inputSize() != input_size ||
+      chunk.outputSize() != output_size ||
+      chunk.labelled() != (task == SYNTHETIC_CLASSIFICATION))
+    chunk = emptyChunk();
+
+  chunk.resize(rows);
+
+  Size parts = pool ? pool->size() * 4 : 1;
+  parts = std::max<Size>(1, std::min<Size>(parts, rows / MIN_TASK_SAMPLES));
+
+  parallel_for(pool, 0, parts, [&](Size part) {
+    Size begin = (uint64_t)rows * part / parts;
+    Size end = (uint64_t)rows * (part + 1) / parts;
+
+    generate(first + begin, end - begin, chunk, begin);
+  });
+}
+
+SyntheticSource::SyntheticSource(const SyntheticGenerator &generator,
+                                 uint64_t samples, ThreadPool *pool,
+                                 Size chunk_size)
+    : generator(generator), samples(samples), position(0), pool(pool),
+      chunk_size(std::max<Size>(1, chunk_size)) {}
+
+void SyntheticSource::rewind() { position = 0; }
+
+bool SyntheticSource::next(Dataset &chunk) {
+  if (position >= samples) {
+    chunk.resize(0);
+    return false;
+  }
+
+  Size rows = std::min<uint64_t>(chunk_size, samples - position);
+
+  generator.generateChunk(position, rows, chunk, pool);
+  position += rows;
+
+  return true;
+}
+
+// append samples [begin, end) of a chunk to `text`, one per line
+static void formatSamples(const Dataset &chunk, Size begin, Size end,
+                          std::string &text) {
+  char buffer[32];
+
+  auto append = [&](Scalar value, char separator) {
+    std::to_chars_result result =
+        std::to_chars(buffer, buffer + sizeof(buffer), value);
+    text.append(buffer, result.ptr);
+    text.push_back(separator);
+  };
+
+  for (Size sample = begin; sample < end; sample++) {
+    for (Size column = 0; column < chunk.inputSize(); column++)
+      append(chunk.inputs(sample, column), ' ');
+
+    // one-hot, for a labelled chunk
+    for (Size output = 0; output < chunk.outputSize(); output++) {
+      Scalar value = chunk.labelled()
+                         ? (chunk.labels[sample] == output ? 1.0f : 0.0f)
+                         : chunk.expected(sample, output);
+      append(value, output + 1 < chunk.outputSize() ? ' ' : '\n');
+    }
+  }
+}
+
+bool writeSyntheticData(std::string filename,
+                        const SyntheticGenerator &generator, uint64_t samples,
+                        bool binary, ThreadPool *pool) {
+  BinaryDatasetWriter writer;
+  std::ofstream text_file;
+
+  if (binary) {
+    if (!writer.open(filename, generator.inputSize(), generator.outputSize(),
+                     samples))
+      return false;
+  } else {
+    text_file.open(filename, std::ios::out | std::ios::binary);
+
+    if (!text_file.is_open())
+      return false;
+  }
+
+  Dataset chunk;
+  // each part of a chunk is formatted on its own, then written in order
+  std::vector<std::string> texts(pool ? pool->size() * 4 : 1);
+
+  for (uint64_t first = 0; first < samples; first += WRITE_CHUNK) {
+    Size rows = std::min<uint64_t>(WRITE_CHUNK, samples - first);
+
+    generator.generateChunk(first, rows, chunk, pool);
+
+    if (binary) {
+      if (!writer.write(chunk))
+        return false;
+      continue;
+    }
+
+    Size parts = texts.size();
+
+    parallel_for(pool, 0, parts, [&](Size part) {
+      texts[part].clear();
+      formatSamples(chunk, (uint64_t)rows * part / parts,
+                    (uint64_t)rows * (part + 1) / parts, texts[part]);
+    });
+
+    for (const std::string &text : texts)
+      text_file.write(text.data(), text.size());
+
+    if (text_file.fail())
+      return false;
+  }
+
+  if (binary)
+    return writer.close();
+
+  text_file.close();
+
+  return !text_file.fail();
+}
@@ -0,0 +1,77 @@
+#ifndef SYNTHETIC_H
+
+#include "Dataset.h"
+#include "NeuralNetwork.h"
+
+#include <cstdint>
+#include <string>
+
+// Synthetic data sets, for benchmarking training at any scale without having
+// to store the data.
+//
+// Every value is a hash of the seed and its position, so sample N is the same
+// however many threads generate it, in whichever chunks, and any sample can
+// be generated without the ones before it. inputs are uniform in [-1, 1).
+
+enum SyntheticTask {
+  // output k is sin(x0 - x1 + x2 - ...), with the signs flipped for odd k
+  // (for 4 inputs and 1 output, the arithmetic network's task)
+  SYNTHETIC_REGRESSION,
+  // the class is the highest of `outputs` fixed random projections of the
+  // inputs, so the classes are linearly separable
+  SYNTHETIC_CLASSIFICATION
+};
+
+class SyntheticGenerator {
+public:
+  SyntheticGenerator(SyntheticTask task, Size input_size, Size output_size,
+                     uint64_t seed);
+
+  // an empty data set of the generated shape (labelled for classification)
+  Dataset emptyChunk() const;
+
+  // generate `rows` samples, from sample `first`, into `chunk` from row `row`
+  void generate(uint64_t first, Size rows, Dataset &chunk, Size row = 0) const;
+
+  // replace `chunk` with `rows` samples from `first`, spread over the pool
+  void generateChunk(uint64_t first, Size rows, Dataset &chunk,
+                     ThreadPool *pool) const;
+
+  Size inputSize() const { return input_size; }
+  Size outputSize() const { return output_size; }
+
+private:
+  SyntheticTask task;
+  Size input_size, output_size;
+  uint64_t seed;
+
+  // one projection per class
+  RowMatrix projections;
+};
+
+// Generates `samples` samples on the fly, a chunk at a time, so training can
+// run on data sets of any size without reading (or storing) a file.
+class SyntheticSource : public DataSource {
+public:
+  SyntheticSource(const SyntheticGenerator &generator, uint64_t samples,
+                  ThreadPool *pool = nullptr, Size chunk_size = 4096);
+
+  void rewind() override;
+  bool next(Dataset &chunk) override;
+
+private:
+  SyntheticGenerator generator;
+  uint64_t samples, position;
+  ThreadPool *pool;
+  Size chunk_size;
+};
+
+// write `samples` generated samples to a text file, or a binary (float32)
+// one, a chunk at a time. returns false if the file could not be written.
+bool writeSyntheticData(std::string filename,
+                        const SyntheticGenerator &generator, uint64_t samples,
+                        bool binary, ThreadPool *pool = nullptr);
+
+#endif
+
+#define SYNTHETIC_H
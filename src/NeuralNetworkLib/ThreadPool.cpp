@@ -0,0 +1,229 @@
+#include "ThreadPool.h"
+
+#include <chrono>
+
+// which pool (if any) the current thread works for, and its deque index
+static thread_local ThreadPool *current_pool = nullptr;
+static thread_local unsigned int current_index = 0;
+
+ThreadPool::ThreadPool(unsigned int threads)
+    : queues(threads < 1 ? 1 : threads), queued(0), next_queue(0),
+      stopping(false), blocking_idle(0) {
+  for (unsigned int index = 0; index + 1 < queues.size(); index++)
+    workers.push_back(std::thread(&ThreadPool::work, this, index));
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex);
+    std::lock_guard<std::mutex> blocking_lock(blocking_mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  blocking_wake.notify_all();
+
+  for (auto &worker : workers)
+    worker.join();
+
+  for (auto &thread : blocking_threads)
+    thread.join();
+}
+
+unsigned int ThreadPool::size() { return queues.size(); }
+
+void ThreadPool::submit(std::function<void()> task) {
+  unsigned int index;
+
+  if (current_pool == this)
+    index = current_index;
+  else
+    // outside callers spread their tasks over all the deques
+    index = next_queue++ % queues.size();
+
+  {
+    std::lock_guard<std::mutex> lock(queues[index].mutex);
+    queues[index].tasks.push_back(std::move(task));
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex);
+    queued++;
+  }
+  wake.notify_one();
+}
+
+void ThreadPool::submitBlocking(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(blocking_mutex);
+    blocking_tasks.push_back(std::move(task));
+
+    // every I/O thread is busy (maybe for good), so start another one
+    if (blocking_idle < blocking_tasks.size())
+      blocking_threads.push_back(std::thread(&ThreadPool::workBlocking, this));
+  }
+  blocking_wake.notify_one();
+}
+
+bool ThreadPool::takeTask(unsigned int index, std::function<void()> &task) {
+  // newest task from our own deque first, it is the most likely to be cached
+  {
+    WorkerQueue &own = queues[index];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.tasks.empty()) {
+      task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      queued--;
+      return true;
+    }
+  }
+
+  // otherwise steal the oldest task of another deque
+  for (unsigned int offset = 1; offset < queues.size(); offset++) {
+    WorkerQueue &victim = queues[(index + offset) % queues.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      queued--;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool ThreadPool::runPendingTask() {
+  if (queued == 0)
+    return false;
+
+  unsigned int index =
+      current_pool == this ? current_index : queues.size() - 1;
+
+  std::function<void()> task;
+
+  if (!takeTask(index, task))
+    return false;
+
+  task();
+  return true;
+}
+
+void ThreadPool::work(unsigned int index) {
+  current_pool = this;
+  current_index = index;
+
+  std::function<void()> task;
+
+  while (true) {
+    if (takeTask(index, task)) {
+      task();
+      task = nullptr;
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(sleep_mutex);
+    wake.wait(lock, [this] { return stopping || queued > 0; });
+
+    if (stopping && queued == 0)
+      return;
+  }
+}
+
+void ThreadPool::workBlocking() {
+  std::unique_lock<std::mutex> lock(blocking_mutex);
+
+  while (true) {
+    blocking_idle++;
+    blocking_wake.wait(lock,
+                       [this] { return stopping || !blocking_tasks.empty(); });
+    blocking_idle--;
+
+    if (blocking_tasks.empty())
+      return;
+
+    std::function<void()> task = std::move(blocking_tasks.front());
+    blocking_tasks.pop_front();
+
+    lock.unlock();
+    task();
+    task = nullptr;
+    lock.lock();
+  }
+}
+
+TaskGroup::TaskGroup(ThreadPool *pool) : pool(pool), pending(0) {}
+
+TaskGroup::~TaskGroup() {
+  // never leave tasks running that refer to this group
+  try {
+    wait();
+  } catch (...) {
+  }
+}
+
+void TaskGroup::run(std::function<void()> task) {
+  if (pool == nullptr || pool->size() == 1) {
+    // nothing to share the work with, so run it right away
+    try {
+      task();
+    } catch (...) {
+      if (!failure)
+        failure = std::current_exception();
+    }
+    return;
+  }
+
+  pool->submit(counted(std::move(task)));
+}
+
+void TaskGroup::runBlocking(std::function<void()> task) {
+  pool->submitBlocking(counted(std::move(task)));
+}
+
+std::function<void()> TaskGroup::counted(std::function<void()> task) {
+  pending++;
+
+  return [this, task] {
+    try {
+      task();
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!failure)
+        failure = std::current_exception();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--pending == 0)
+      finished.notify_all();
+  };
+}
+
+void TaskGroup::wait() {
+  while (pending > 0) {
+    if (pool->runPendingTask())
+      continue;
+
+    // nothing left to help with, so sleep until our tasks finish, checking
+    // now and then for new work that they may have queued.
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait_for(lock, std::chrono::microseconds(200),
+                      [this] { return pending == 0; });
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (failure) {
+    std::exception_ptr rethrown = failure;
+    failure = nullptr;
+    std::rethrow_exception(rethrown);
+  }
+}
+
+void parallel_for(ThreadPool *pool, unsigned int first, unsigned int last,
+                  std::function<void(unsigned int)> body) {
+  TaskGroup group(pool);
+
+  for (unsigned int index = first; index < last; index++)
+    group.run([&body, index] { body(index); });
+
+  group.wait();
+}
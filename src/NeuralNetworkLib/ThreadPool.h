@@ -0,0 +1,107 @@
+#ifndef THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A work-stealing pool of threads shared by the whole library.
+//
+// Each worker has its own deque of tasks: it takes new work from the back of
+// its own deque, and when that runs dry it steals from the front of the other
+// workers' deques. Threads waiting on a TaskGroup (including the thread that
+// owns the pool) run pending tasks while they wait, so nested parallelism
+// never deadlocks, and a pool of size 1 simply runs everything inline.
+//
+// Tasks that block for long stretches (reading a file, or waiting for a
+// consumer to catch up) go to a separate lane of I/O threads instead, so they
+// never hold up a worker. I/O threads are only started when all of them are
+// busy, and are kept for later tasks, so a session starts no more of them
+// than it ever runs at once.
+class ThreadPool {
+public:
+  // `threads` counts the calling thread, so `threads - 1` workers are spawned.
+  ThreadPool(unsigned int threads);
+  ~ThreadPool();
+
+  // number of threads that can run tasks at once
+  unsigned int size();
+
+  // queue a task. tasks queued from a worker go to that worker's own deque.
+  void submit(std::function<void()> task);
+
+  // run one queued task on the calling thread, if there is any.
+  // returns whether a task was run.
+  bool runPendingTask();
+
+  // run a task that may block on an I/O thread.
+  void submitBlocking(std::function<void()> task);
+
+private:
+  struct WorkerQueue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  void work(unsigned int index);
+  void workBlocking();
+
+  bool takeTask(unsigned int index, std::function<void()> &task);
+
+  // one deque per worker, plus a last one for tasks submitted from outside
+  std::vector<WorkerQueue> queues;
+  std::vector<std::thread> workers;
+
+  std::mutex sleep_mutex;
+  std::condition_variable wake;
+  std::atomic<unsigned int> queued;
+  std::atomic<unsigned int> next_queue;
+  bool stopping;
+
+  // the I/O lane, and how many of its threads wait for a task
+  std::mutex blocking_mutex;
+  std::condition_variable blocking_wake;
+  std::deque<std::function<void()>> blocking_tasks;
+  std::vector<std::thread> blocking_threads;
+  unsigned int blocking_idle;
+};
+
+// A set of tasks that can be waited on together. The first exception thrown by
+// a task is rethrown from wait(). With no pool, tasks run inline.
+class TaskGroup {
+public:
+  TaskGroup(ThreadPool *pool);
+  ~TaskGroup();
+
+  void run(std::function<void()> task);
+
+  // run a task that may block on the pool's I/O lane (see ThreadPool). unlike
+  // run(), it needs a pool, and is never run inline.
+  void runBlocking(std::function<void()> task);
+
+  // help run queued tasks until every task of this group has finished
+  void wait();
+
+private:
+  // `task`, counted in `pending` until it finishes
+  std::function<void()> counted(std::function<void()> task);
+
+  ThreadPool *pool;
+  std::atomic<unsigned int> pending;
+  std::mutex mutex;
+  std::condition_variable finished;
+  std::exception_ptr failure;
+};
+
+// run body(index) for every index in [first, last), one task each, on the pool
+// (or inline when there is none).
+void parallel_for(ThreadPool *pool, unsigned int first, unsigned int last,
+                  std::function<void(unsigned int)> body);
+
+#endif
+
+#define THREADPOOL_H
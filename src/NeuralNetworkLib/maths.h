@@ -2,13 +2,75 @@
 
 #include "NeuralNetwork.h"
 
-std::function<Scalar(Scalar)> unaryActivation(ActivationFunction a);
+// compile-time activation kernels. these work on whole Eigen arrays, so the
+// transcendental functions use Eigen's vectorised (packet) versions.
+template <ActivationFunction A, typename Derived>
+auto activate(const Eigen::ArrayBase<Derived> &x) {
+  if constexpr (A == SIGMOID)
+    return (Scalar(1) + (-x).exp()).inverse();
+  else if constexpr (A == TANH)
+    return x.tanh();
+  else if constexpr (A == BINARY)
+    return (x > Scalar(0)).template cast<Scalar>();
+  else
+    return x.derived();
+}
 
-std::function<Scalar(Scalar)> unaryActivationDerivative(ActivationFunction a);
+// derivative of an activation, computed from its output y = activate(x)
+// rather than its input, so no transcendental has to be evaluated again.
+template <ActivationFunction A, typename Derived>
+auto activateDerivative(const Eigen::ArrayBase<Derived> &y) {
+  if constexpr (A == SIGMOID)
+    return y * (Scalar(1) - y);
+  else if constexpr (A == TANH)
+    return Scalar(1) - y.square();
+  else
+    // none or binary
+    return Eigen::ArrayBase<Derived>::Constant(y.rows(), y.cols(), Scalar(1));
+}
 
-Vector activation(Vector v, ActivationFunction a);
+// write activate(x) into y, choosing the kernel once for the whole layer.
+// (y is taken as const, and cast back, so that blocks can be passed in)
+template <typename In, typename Out>
+void applyActivation(ActivationFunction a, const Eigen::MatrixBase<In> &x,
+                     const Eigen::MatrixBase<Out> &y) {
+  Out &out = const_cast<Out &>(y.derived());
 
-Vector activationDerivative(Vector v, ActivationFunction a);
+  switch (a) {
+  case ActivationFunction::SIGMOID:
+    out = activate<SIGMOID>(x.array()).matrix();
+    break;
+  case ActivationFunction::TANH:
+    out = activate<TANH>(x.array()).matrix();
+    break;
+  case ActivationFunction::BINARY:
+    out = activate<BINARY>(x.array()).matrix();
+    break;
+  default:
+    // none
+    out = x;
+  }
+}
+
+// multiply error by the derivative of the activation that produced y
+template <typename Out, typename Err>
+void applyActivationDerivative(ActivationFunction a,
+                               const Eigen::MatrixBase<Out> &y,
+                               const Eigen::MatrixBase<Err> &error) {
+  Err &err = const_cast<Err &>(error.derived());
+
+  switch (a) {
+  case ActivationFunction::SIGMOID:
+    err.array() *= activateDerivative<SIGMOID>(y.array());
+    break;
+  case ActivationFunction::TANH:
+    err.array() *= activateDerivative<TANH>(y.array());
+    break;
+  default:
+    // none or binary, derivative is 1
+    break;
+  }
+}
 
 Scalar sabs(Scalar x);
 
@@ -0,0 +1,84 @@
+#include "NeuralNetwork.h"
+#include "Synthetic.h"
+#include "ThreadPool.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+// Writes synthetic data sets of any size, for benchmarking training, e.g.
+//
+//   datagen regression 4 1 1000000 networks/arithmetic/training_data.txt
+//   datagen classification 16 26 100000000 big.bin --binary --seed 7
+
+void print_error(std::string msg) {
+  // print error message, with some nice ANSI colors, if supported
+  std::cout << "\033[1;31m"<< "[ERROR] " << msg << "\033[0m" << std::endl;
+}
+
+void print_info(std::string msg) {
+  // print info message, with some nice ANSI colors, if supported
+  std::cout << "\033[1;32m"<< "[INFO] " << msg << "\033[0m" << std::endl;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 6) {
+    print_error("Usage: " + std::string(argv[0]) + " <regression|classification> <inputs> <outputs> <samples> <output file> [--binary] [--seed <n>] [--threads <n>]");
+    return 1;
+  }
+
+  std::string task_name = argv[1];
+
+  if (task_name != "regression" && task_name != "classification") {
+    print_error("Unknown task " + task_name + ", expected regression or classification.");
+    return 1;
+  }
+
+  SyntheticTask task = task_name == "regression" ? SYNTHETIC_REGRESSION : SYNTHETIC_CLASSIFICATION;
+
+  Size inputs = std::stoul(argv[2]);
+  Size outputs = std::stoul(argv[3]);
+  uint64_t samples = std::stoull(argv[4]);
+  std::string filename = argv[5];
+
+  if (inputs < 1 || outputs < 1 || (task == SYNTHETIC_CLASSIFICATION && outputs < 2)) {
+    print_error("Needs at least 1 input and 1 output (2 classes for classification).");
+    return 1;
+  }
+
+  bool binary = false;
+  uint64_t seed = 0;
+  Size threads = std::thread::hardware_concurrency();
+
+  for (int arg = 6; arg < argc; arg++) {
+    std::string option = argv[arg];
+
+    if (option == "--binary")
+      binary = true;
+    else if (option == "--seed" && arg + 1 < argc)
+      seed = std::stoull(argv[++arg]);
+    else if (option == "--threads" && arg + 1 < argc)
+      threads = std::stoi(argv[++arg]);
+  }
+
+  if (threads < 1)
+    threads = 1;
+
+  ThreadPool pool(threads);
+
+  SyntheticGenerator generator(task, inputs, outputs, seed);
+
+  auto start_time = std::chrono::steady_clock::now();
+
+  if (!writeSyntheticData(filename, generator, samples, binary, &pool)) {
+    print_error("Failed to write " + filename + ".");
+    return 1;
+  }
+
+  std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start_time;
+
+  print_info("Wrote " + std::to_string(samples) + " examples to " + filename + " in " + std::to_string(seconds.count()) + " s.");
+
+  return 0;
+}
@@ -1,15 +1,35 @@
 #include "NeuralNetwork.h"
 #include "NetworkReflection.h"
+#include "Dataset.h"
+#include "Synthetic.h"
+#include "Pipeline.h"
+#include "SharedDataset.h"
+#include "ThreadPool.h"
 
 #include <iostream>
 #include <fstream>
-#include <ctime>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <chrono>
 #include <string>
+#include <thread>
 
+// parsed data sets are kept between commands, along with the modification
+// time of their file when they were read
+struct CachedDataset {
+  Dataset data;
+  std::filesystem::file_time_type modified;
+};
+
+typedef std::map<std::string, CachedDataset> DatasetCache;
 
 bool file_exists(std::string filename);
 void print_error(std::string msg);
 void print_info(std::string msg);
+const Dataset &load_dataset(DatasetCache &cache, std::string filename, Topology &topology, ThreadPool &pool);
+size_t dataset_bytes(const Dataset &data);
 
 int main(int argc, char **argv) {
   // we get folder name as argv[1]
@@ -19,15 +39,32 @@ int main(int argc, char **argv) {
   std::cout << "Licensed under WTFPL (http://www.wtfpl.net/txt/copying)" << std::endl;
   
   if (argc < 2) {
-    print_error( "Usage: " + std::string(argv[0]) + " <network folder>");
+    print_error( "Usage: " + std::string(argv[0]) + " <network folder> [--threads <n>]");
     return 1;
   }
 
   std::string folder_name = argv[1];
 
+  // one pool is shared by every command for the whole session
+  Size threads = std::thread::hardware_concurrency();
+
+  for (int arg = 2; arg + 1 < argc; arg++) {
+    if (std::string(argv[arg]) == "--threads")
+      threads = std::stoi(argv[++arg]);
+  }
+
+  if (threads < 1)
+    threads = 1;
+
+  ThreadPool pool(threads);
+
   std::string topology_filename = folder_name + "/topology.txt";
   std::string weights_filename = folder_name + "/weights.bin";
-  std::string training_data_filename = folder_name + "/training_data.txt";
+  // a binary training set is preferred over the text one
+  std::string training_data_filename = folder_name + "/training_data.bin";
+
+  if (!file_exists(training_data_filename))
+    training_data_filename = folder_name + "/training_data.txt";
   std::string configuration_filename = folder_name + "/config.txt";
 
   if (!file_exists(topology_filename)) {
@@ -43,29 +80,45 @@ int main(int argc, char **argv) {
   Scalar top_rate = 0.01;
   Scalar bot_rate = 0.0001;
 
-  Configuration config = readConfiguration(configuration_filename);
+  Configuration config;
+
+  try {
+    config = readConfiguration(configuration_filename);
+  } catch (const std::runtime_error &error) {
+    print_error(error.what());
+    return 1;
+  }
 
   Topology topology = readTopology(topology_filename);
 
-  NeuralNetwork *network;
+  NeuralNetwork *network = new NeuralNetwork(config, topology);
 
   if (file_exists(weights_filename)) { 
     print_info("Loading weights from file " + weights_filename + "...");
     // load weights
-    NetworkWeights weights = readWeights(weights_filename, topology);
-    print_info("Weights loaded.");
-    network = new NeuralNetwork(config, topology, weights);
+    if (readWeights(weights_filename, network->weights))
+      print_info("Weights loaded.");
+    else
+      print_error("Weights file is incomplete, some weights are left random.");
   } else {
     print_info("No weights file found. Creating new network with random weights...");
-    // create new network
-    network = new NeuralNetwork(config, topology);
   }
 
+  network->useThreadPool(&pool);
+
+  print_info("Using " + std::to_string(pool.size()) + " thread(s).");
+
   // main program loop
 
   std::vector<std::string> tokens;
   std::string input;
 
+  DatasetCache datasets;
+
+  // column statistics of the last data set trained on with `standardize`,
+  // which test data is standardized with too
+  ColumnStatistics input_statistics;
+
   while (!std::cin.eof()) {
 
     tokens.clear();
@@ -78,6 +131,9 @@ int main(int argc, char **argv) {
 
     for (std::string command; std::getline(input_stream, command, ' '); tokens.push_back(command));
 
+    if (tokens.empty())
+      continue;
+
     if (tokens[0] == "exit") {
       return 0;
     }
@@ -94,14 +150,28 @@ int main(int argc, char **argv) {
     if (tokens[0] == "train") {
 
       if (tokens.size() < 3) {
-        print_error("Usage: train <epochs> <statistics file (relative to network dir)>");
+        print_error("Usage: train <epochs> <statistics file (relative to network dir)> [stream [chunk size] | holdout <fraction> | synthetic <regression|classification> <samples> [seed]]");
         continue;
       }
 
       std::string statistics_filename = folder_name + "/" + tokens[2];
 
-      if (!file_exists(training_data_filename)) {
-        print_error("Training data file (training_data.txt) does not exist.");
+      // synthetic samples are generated as they are trained on, without any
+      // file, to benchmark data sets of any size
+      bool synthetic = tokens.size() > 3 && tokens[3] == "synthetic";
+
+      if (synthetic && (tokens.size() < 6 || (tokens[4] != "regression" && tokens[4] != "classification"))) {
+        print_error("Usage: train <epochs> <statistics file> synthetic <regression|classification> <samples> [seed]");
+        continue;
+      }
+
+      if (synthetic && tokens[4] == "classification" && topology.back() < 2) {
+        print_error("Synthetic classification needs at least 2 outputs.");
+        continue;
+      }
+
+      if (!synthetic && !file_exists(training_data_filename)) {
+        print_error("Training data file (training_data.txt or training_data.bin) does not exist.");
         continue;
       }
 
@@ -121,11 +191,48 @@ int main(int argc, char **argv) {
 
       Size epochs = std::stoi(tokens[1]);
 
+      // streaming reads the data from disk a chunk at a time, for data sets
+      // that do not fit in memory
+      bool streaming = tokens.size() > 3 && tokens[3] == "stream";
+      Size chunk_size = streaming && tokens.size() > 4 ? std::stoi(tokens[4]) : 4096;
+
+      // a held out part of the data set is only used to validate the network
+      // after training
+      Scalar holdout = tokens.size() > 4 && tokens[3] == "holdout" ? std::stof(tokens[4]) : 0;
+
+      if (holdout > 0 && config.transforms.active()) {
+        print_error("Input transforms can not be used with holdout.");
+        continue;
+      }
+
+      const Dataset *training_data = nullptr;
+
+      if (!streaming && !synthetic) {
+        try {
+          training_data = &load_dataset(datasets, training_data_filename, topology, pool);
+        } catch (const std::runtime_error &error) {
+          print_error(error.what());
+          continue;
+        }
+
+        if (training_data->empty()) {
+          print_error("No training examples could be read.");
+          continue;
+        }
+      }
+
+      StreamingDataSource source(streaming ? training_data_filename : "", topology, pool, chunk_size);
+
+      if (streaming && !source.isOpen()) {
+        print_error("Training data file could not be streamed.");
+        continue;
+      }
+
       print_info("Training network for " + tokens[1] + "  epochs.");
 
-      TrainingData training_data = readTrainingData(training_data_filename, topology);
+      DatasetView validation;
 
-      Size start_time = std::clock();
+      auto start_time = std::chrono::steady_clock::now();
 
       Scalar start_error;
       Scalar end_error;
@@ -141,7 +248,45 @@ int main(int argc, char **argv) {
         return 1;
       };
 
-      network->train(training_data, epochs, hook);
+      // data read a chunk at a time. with transforms, in-memory data is too,
+      // so that it can go through the producer threads on its way to training
+      std::unique_ptr<DataSource> chunks;
+
+      if (synthetic) {
+        SyntheticGenerator generator(tokens[4] == "regression" ? SYNTHETIC_REGRESSION : SYNTHETIC_CLASSIFICATION,
+                                     topology.front(), topology.back(),
+                                     tokens.size() > 6 ? std::stoull(tokens[6]) : 0);
+        chunks = std::make_unique<SyntheticSource>(generator, std::stoull(tokens[5]), &pool);
+      } else if (config.transforms.active() && !streaming) {
+        chunks = std::make_unique<DatasetSource>(*training_data);
+      }
+
+      DataSource *upstream = streaming ? &source : chunks.get();
+
+      if (upstream != nullptr) {
+        try {
+          if (config.transforms.active()) {
+            if (config.transforms.standardize)
+              input_statistics = computeColumnStatistics(*upstream);
+
+            TransformSource transformed(*upstream, config.transforms, input_statistics, pool, config.seed);
+            network->train(transformed, epochs, hook);
+          } else {
+            network->train(*upstream, epochs, hook);
+          }
+        } catch (const std::runtime_error &error) {
+          std::cout << std::endl;
+          print_error(error.what());
+          continue;
+        }
+      } else if (holdout > 0) {
+        DatasetView training;
+        splitDataset(*training_data, holdout, 0, training, validation);
+
+        network->train(training, epochs, hook);
+      } else {
+        network->train(*training_data, epochs, hook);
+      }
     // print average error for last epoch
 
       std::cout << "\n Error went from " << start_error << " to " << end_error
@@ -150,16 +295,130 @@ int main(int argc, char **argv) {
 
       statistics_file.close();
 
-      Size tot_time = std::clock() - start_time;
-
-      Scalar ms_time = tot_time / ((Scalar) CLOCKS_PER_SEC * 1000);
+      // wall clock time, since training may run on several threads
+      std::chrono::duration<Scalar, std::milli> ms_time =
+          std::chrono::steady_clock::now() - start_time;
 
-      Scalar average_time = ms_time / (epochs);
+      Scalar average_time = ms_time.count() / (epochs);
 
       print_info("Training complete.");
 
       print_info("Training took " + std::to_string(average_time) + " ms per epoch on average.");
 
+      if (!validation.empty()) {
+        Scalar validation_error = network->test(validation, [](const VectorView &, const VectorView &, Scalar) -> int { return 1; });
+
+        if (topology.back() == 1)
+          std::cout << "Validation average error (" << validation.size() << " held out examples): " << validation_error << std::endl;
+        else
+          std::cout << "Validation accuracy (" << validation.size() << " held out examples): " << validation_error * 100 << "%" << std::endl;
+      }
+
+      continue;
+    }
+
+    if (tokens[0] == "crossval") {
+      if (tokens.size() < 4) {
+        print_error("Usage: crossval <folds> <epochs> <statistics file (relative to network dir)>");
+        continue;
+      }
+
+      Size folds = std::stoi(tokens[1]);
+      Size epochs = std::stoi(tokens[2]);
+      std::string statistics_filename = folder_name + "/" + tokens[3];
+
+      if (folds < 2) {
+        print_error("Cross validation needs at least 2 folds.");
+        continue;
+      }
+
+      if (config.transforms.active()) {
+        print_error("Input transforms can not be used with crossval.");
+        continue;
+      }
+
+      if (!file_exists(training_data_filename)) {
+        print_error("Training data file (training_data.txt or training_data.bin) does not exist.");
+        continue;
+      }
+
+      if (file_exists(statistics_filename)) {
+        print_error("Statistics file already exists. Please delete it or choose a different name.");
+        continue;
+      }
+
+      const Dataset *training_data;
+
+      try {
+        training_data = &load_dataset(datasets, training_data_filename, topology, pool);
+      } catch (const std::runtime_error &error) {
+        print_error(error.what());
+        continue;
+      }
+
+      if (training_data->size() < folds) {
+        print_error("Not enough training examples for " + tokens[1] + " folds.");
+        continue;
+      }
+
+      std::ofstream statistics_file(statistics_filename, std::ios::out);
+
+      if (!statistics_file.is_open()) {
+        print_error("Failed to open statistics file for writing.");
+        continue;
+      }
+
+      statistics_file << "fold,epoch,error,learning_rate" << std::endl;
+
+      // every fold is a view of the one loaded data set, and starts from a
+      // copy of the current network, which is left as it is
+      std::vector<DatasetView> training(folds), validation(folds);
+      std::vector<NeuralNetwork> networks;
+      networks.reserve(folds);
+
+      for (Size fold = 0; fold < folds; fold++) {
+        foldDataset(*training_data, folds, fold, 0, training[fold], validation[fold]);
+        networks.emplace_back(*network);
+      }
+
+      print_info("Training " + tokens[1] + " folds for " + tokens[2] + " epochs.");
+
+      auto start_time = std::chrono::steady_clock::now();
+
+      NeuralNetwork::trainTogether(networks, training, epochs, [&statistics_file, folds](Size fold, Size epoch, Scalar error, Scalar learning_rate) -> int {
+        if (fold == folds - 1)
+          std::cout << "epoch " << epoch << "\t\r" << std::flush;
+
+        statistics_file << fold << "," << epoch << "," << error << "," << learning_rate << std::endl;
+        return 1;
+      });
+
+      std::cout << std::endl;
+
+      statistics_file.close();
+
+      std::chrono::duration<Scalar, std::milli> ms_time =
+          std::chrono::steady_clock::now() - start_time;
+
+      Scalar total = 0.0;
+
+      for (Size fold = 0; fold < folds; fold++) {
+        Scalar result = networks[fold].test(validation[fold], [](const VectorView &, const VectorView &, Scalar) -> int { return 1; });
+        total += result;
+
+        if (topology.back() == 1)
+          std::cout << "Fold " << fold << " average error: " << result << std::endl;
+        else
+          std::cout << "Fold " << fold << " accuracy: " << result * 100 << "%" << std::endl;
+      }
+
+      if (topology.back() == 1)
+        std::cout << "Mean average error: " << total / folds << std::endl;
+      else
+        std::cout << "Mean accuracy: " << total / folds * 100 << "%" << std::endl;
+
+      print_info("Cross validation took " + std::to_string(ms_time.count() / epochs) + " ms per epoch on average.");
+
       continue;
     }
 
@@ -182,7 +441,7 @@ int main(int argc, char **argv) {
         input.coeffRef(i) = val;
       }
 
-      Vector output = network->generate(input);
+      const VectorMap &output = network->generate(input);
 
       std::cout << "Output: " << output <<  std::endl;
       continue;
@@ -208,13 +467,44 @@ int main(int argc, char **argv) {
         continue;
       }
 
-      TrainingData test_data = readTrainingData(test_data_filename, topology);
+      const Dataset *test_data;
+
+      try {
+        test_data = &load_dataset(datasets, test_data_filename, topology, pool);
+      } catch (const std::runtime_error &error) {
+        print_error(error.what());
+        continue;
+      }
+
+      if (test_data->empty()) {
+        print_error("No test examples could be read.");
+        continue;
+      }
 
       std::ofstream statistics_file(test_output_filename, std::ios::out);
 
       statistics_file << "input,output,error" << std::endl;
 
-      Scalar average_error = network->test(test_data, [&statistics_file](Vector input, Vector output, Scalar error) -> int {
+      // the same transforms as in training, bar the noise
+      Dataset transformed_data;
+
+      if (config.transforms.standardize || config.transforms.clip) {
+        if (config.transforms.standardize && input_statistics.empty() && file_exists(training_data_filename)) {
+          try {
+            DatasetSource training_source(load_dataset(datasets, training_data_filename, topology, pool));
+            input_statistics = computeColumnStatistics(training_source);
+          } catch (const std::runtime_error &error) {
+            print_error(error.what());
+            continue;
+          }
+        }
+
+        transformed_data = *test_data;
+        transformInputs(config.transforms, input_statistics, transformed_data);
+        test_data = &transformed_data;
+      }
+
+      Scalar average_error = network->test(*test_data, [&statistics_file](const VectorView &input, const VectorView &output, Scalar error) -> int {
         statistics_file << "" << input << "," << output << "," << error << "\n";
         return 1;
       });
@@ -227,6 +517,225 @@ int main(int argc, char **argv) {
       continue;
     }
 
+    if (tokens[0] == "convert") {
+      if (tokens.size() < 3) {
+        print_error("Usage: convert <text data file> <binary data file> [float32] (relative to network dir)");
+        continue;
+      }
+
+      std::string text_filename = folder_name + "/" + tokens[1];
+      std::string binary_filename = folder_name + "/" + tokens[2];
+
+      if (!file_exists(text_filename)) {
+        print_error("Data file does not exist.");
+        continue;
+      }
+
+      if (file_exists(binary_filename)) {
+        print_error("Binary data file already exists.");
+        continue;
+      }
+
+      const Dataset *data;
+
+      try {
+        data = &load_dataset(datasets, text_filename, topology, pool);
+      } catch (const std::runtime_error &error) {
+        print_error(error.what());
+        continue;
+      }
+
+      // columns are stored compactly unless plain floats are asked for
+      bool encode = tokens.size() < 4 || tokens[3] != "float32";
+
+      if (saveBinaryTrainingData(binary_filename, *data, encode))
+        print_info("Wrote " + std::to_string(data->size()) + " examples to " + binary_filename + ".");
+      else
+        print_error("Failed to write binary data file.");
+
+      continue;
+    }
+
+    if (tokens[0] == "ingest") {
+      if (tokens.size() < 4) {
+        print_error("Usage: ingest <csv file> <spec file> <binary data file> (relative to network dir)");
+        continue;
+      }
+
+      std::string csv_filename = folder_name + "/" + tokens[1];
+      std::string spec_filename = folder_name + "/" + tokens[2];
+      std::string binary_filename = folder_name + "/" + tokens[3];
+
+      if (!file_exists(csv_filename)) {
+        print_error("CSV file does not exist.");
+        continue;
+      }
+
+      if (file_exists(binary_filename)) {
+        print_error("Binary data file already exists.");
+        continue;
+      }
+
+      Dataset data;
+
+      try {
+        IngestSpec spec = readIngestSpec(spec_filename);
+
+        if (spec.feature_columns.size() != topology.front() || spec.vocabulary.size() != topology.back()) {
+          print_error("Spec has " + std::to_string(spec.feature_columns.size()) + " features and " + std::to_string(spec.vocabulary.size()) + " labels, the network needs " + std::to_string(topology.front()) + " and " + std::to_string(topology.back()) + ".");
+          continue;
+        }
+
+        data = ingestCsv(csv_filename, spec, &pool);
+      } catch (const std::runtime_error &error) {
+        print_error(error.what());
+        continue;
+      }
+
+      if (saveBinaryTrainingData(binary_filename, data, true))
+        print_info("Wrote " + std::to_string(data.size()) + " examples to " + binary_filename + ".");
+      else
+        print_error("Failed to write binary data file.");
+
+      continue;
+    }
+
+    if (tokens[0] == "load") {
+      if (tokens.size() < 2) {
+        print_error("Usage: load <data file (relative to network dir)>");
+        continue;
+      }
+
+      std::string data_filename = folder_name + "/" + tokens[1];
+
+      if (!file_exists(data_filename)) {
+        print_error("Data file does not exist.");
+        continue;
+      }
+
+      try {
+        const Dataset &data = load_dataset(datasets, data_filename, topology, pool);
+        print_info("Loaded " + std::to_string(data.size()) + " examples from " + data_filename + ".");
+      } catch (const std::runtime_error &error) {
+        print_error(error.what());
+      }
+
+      continue;
+    }
+
+    if (tokens[0] == "unload") {
+      if (tokens.size() < 2) {
+        print_error("Usage: unload <data file (relative to network dir)|all>");
+        continue;
+      }
+
+      if (tokens[1] == "all") {
+        datasets.clear();
+        print_info("Unloaded all data sets.");
+      } else if (datasets.erase(folder_name + "/" + tokens[1]) > 0) {
+        print_info("Unloaded " + folder_name + "/" + tokens[1] + ".");
+      } else {
+        print_error("Data set is not loaded.");
+      }
+
+      continue;
+    }
+
+    if (tokens[0] == "publish") {
+      if (tokens.size() < 3) {
+        print_error("Usage: publish <data file (relative to network dir)> <shared name>");
+        continue;
+      }
+
+      std::string data_filename = folder_name + "/" + tokens[1];
+
+      if (!file_exists(data_filename)) {
+        print_error("Data file does not exist.");
+        continue;
+      }
+
+      try {
+        const Dataset &data = load_dataset(datasets, data_filename, topology, pool);
+        Size samples = data.size();
+
+        if (!publishSharedDataset(tokens[2], data)) {
+          print_error("Could not publish " + tokens[2] + " (is the name already taken?).");
+          continue;
+        }
+
+        // use the shared copy from now on, and drop our own
+        Dataset shared = attachSharedDataset(tokens[2], topology);
+
+        if (shared.size() == samples)
+          datasets[data_filename].data = std::move(shared);
+
+        print_info("Published " + std::to_string(samples) + " examples from " + data_filename + " as " + tokens[2] + ".");
+      } catch (const std::runtime_error &error) {
+        print_error(error.what());
+      }
+
+      continue;
+    }
+
+    if (tokens[0] == "attach") {
+      if (tokens.size() < 3) {
+        print_error("Usage: attach <data file (relative to network dir)> <shared name>");
+        continue;
+      }
+
+      std::string data_filename = folder_name + "/" + tokens[1];
+
+      Dataset data = attachSharedDataset(tokens[2], topology);
+
+      if (data.empty()) {
+        print_error("No shared data set " + tokens[2] + " that fits the topology.");
+        continue;
+      }
+
+      // it stands in for the file, for as long as the file is not changed
+      std::error_code error;
+      std::filesystem::file_time_type modified = std::filesystem::last_write_time(data_filename, error);
+
+      Size samples = data.size();
+      datasets[data_filename] = {std::move(data), modified};
+
+      print_info("Attached " + std::to_string(samples) + " examples from " + tokens[2] + " as " + data_filename + ".");
+
+      continue;
+    }
+
+    if (tokens[0] == "unpublish") {
+      if (tokens.size() < 2) {
+        print_error("Usage: unpublish <shared name>");
+        continue;
+      }
+
+      if (unpublishSharedDataset(tokens[1]))
+        print_info("Unpublished " + tokens[1] + ", attached processes keep it until they unload it.");
+      else
+        print_error("No shared data set " + tokens[1] + ".");
+
+      continue;
+    }
+
+    if (tokens[0] == "datasets") {
+      if (datasets.empty())
+        print_info("No data sets loaded.");
+
+      for (auto &[filename, cached] : datasets) {
+        const Dataset &data = cached.data;
+
+        std::cout << filename << ": " << data.size() << " examples, "
+                  << dataset_bytes(data) / (1024.0 * 1024.0) << " MiB"
+                  << (data.sparse() ? ", sparse inputs" : "")
+                  << (data.isShared() ? ", shared" : "")
+                  << (data.isEncoded() ? ", encoded" : "")
+                  << (data.labelled() ? ", labelled" : "") << std::endl;
+      }
+
+      continue;
+    }
+
     print_error( "Command not recognised: " + tokens[0] + ".");
   }
 }
@@ -240,6 +749,43 @@ bool file_exists(std::string filename) {
   return res;
 }
 
+const Dataset &load_dataset(DatasetCache &cache, std::string filename, Topology &topology, ThreadPool &pool) {
+  std::error_code error;
+  std::filesystem::file_time_type modified = std::filesystem::last_write_time(filename, error);
+
+  auto cached = cache.find(filename);
+
+  // only parse the file again if it has changed since
+  if (cached != cache.end() && !error && cached->second.modified == modified)
+    return cached->second.data;
+
+  // drop the stale copy first, so that both are never held at once
+  cache.erase(filename);
+
+  Dataset data = readTrainingData(filename, topology, &pool);
+
+  CachedDataset &entry = cache[filename];
+  entry = {std::move(data), modified};
+
+  return entry.data;
+}
+
+size_t dataset_bytes(const Dataset &data) {
+  size_t bytes = (data.inputMatrix().size() + data.expectedMatrix().size()) * sizeof(Scalar) +
+                 (data.labelled() ? data.size() : 0) * sizeof(Size) +
+                 data.encoded.bytes;
+
+  // a dense set still reports an (empty) CSR matrix, with one row per sample
+  if (data.sparse()) {
+    SparseRowsMap sparse_inputs = data.sparseInputs();
+
+    bytes += sparse_inputs.nonZeros() * (sizeof(Scalar) + sizeof(int)) +
+             (sparse_inputs.outerSize() + 1) * sizeof(int);
+  }
+
+  return bytes;
+}
+
 void print_error(std::string msg) {
   // print error message, with some nice ANSI colors, if supported
   std::cout << "\033[1;31m"<< "[ERROR] " << msg << "\033[0m" << std::endl;
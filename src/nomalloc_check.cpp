@@ -0,0 +1,98 @@
+#include "NeuralNetwork.h"
+#include "Synthetic.h"
+#include "ThreadPool.h"
+
+#include <iostream>
+#include <string>
+
+// Checks that the steady state of training and inference never allocates, e.g.
+//
+//   cmake --build debug && debug/nomalloc_check
+//
+// Debug builds define EIGEN_RUNTIME_NO_MALLOC, so any heap allocation by
+// Eigen inside the NoMallocScope below (a temporary, a resize) aborts on an
+// assertion. Runs one batched epoch, one HOGWILD epoch and generateBatch on a
+// small network, which keeps the blocking space of Eigen's products on the
+// stack. Release builds have nothing to check.
+
+void print_error(std::string msg) {
+  // print error message, with some nice ANSI colors, if supported
+  std::cout << "\033[1;31m"<< "[ERROR] " << msg << "\033[0m" << std::endl;
+}
+
+void print_info(std::string msg) {
+  // print info message, with some nice ANSI colors, if supported
+  std::cout << "\033[1;32m"<< "[INFO] " << msg << "\033[0m" << std::endl;
+}
+
+static Configuration checkConfiguration(Size batch_size, TrainingMode mode) {
+  Configuration config;
+
+  config.top_rate = 0.01;
+  config.bot_rate = 0.001;
+  config.decay_rate = 0;
+  config.cycle_length = 1000;
+  config.hidden_activation = TANH;
+  config.output_activation = SIGMOID;
+  config.batch_size = batch_size;
+  config.threads = 2;
+  config.mode = mode;
+  config.shuffle = SHUFFLE_FULL;
+  config.shuffle_block = 4096;
+  config.seed = 0;
+  config.sampling = SAMPLING_UNIFORM;
+  config.sample_fraction = 1.0;
+  config.transforms = {false, 0.0, false, 0.0, 0.0, 1};
+
+  return config;
+}
+
+int main() {
+#ifndef EIGEN_RUNTIME_NO_MALLOC
+  print_info("Built without EIGEN_RUNTIME_NO_MALLOC (not a Debug build), nothing to check.");
+  return 0;
+#endif
+
+  ThreadPool pool(2);
+
+  SyntheticGenerator generator(SYNTHETIC_CLASSIFICATION, 16, 4, 0);
+  Dataset data = generator.emptyChunk();
+  generator.generateChunk(0, 512, data, &pool);
+
+  Topology topology = {16, 24, 4};
+
+  NeuralNetwork batched(checkConfiguration(32, SYNCHRONOUS), topology);
+  NeuralNetwork hogwild(checkConfiguration(1, HOGWILD), topology);
+  batched.useThreadPool(&pool);
+  hogwild.useThreadPool(&pool);
+
+  Scalar batched_error = 0, hogwild_error = 0;
+  Matrix outputs;
+
+  {
+    // only the buffers each run lays out first (under an AllocationCheckPause)
+    // may allocate
+    NoMallocScope no_malloc;
+
+    batched.train(data, 1, [&](Size, Scalar error, Scalar) {
+      batched_error = error;
+      return 0;
+    });
+
+    hogwild.train(data, 1, [&](Size, Scalar error, Scalar) {
+      hogwild_error = error;
+      return 0;
+    });
+
+    batched.generateBatch(data.inputMatrix(), outputs);
+  }
+
+  if (!(batched_error > 0) || !(hogwild_error > 0) ||
+      outputs.rows() != (Eigen::Index)data.size() || !outputs.allFinite()) {
+    print_error("Training or inference produced no sensible result.");
+    return 1;
+  }
+
+  print_info("No allocations in a batched epoch, a HOGWILD epoch or generateBatch.");
+  return 0;
+}
@@ -0,0 +1,68 @@
+#include "StaticNeuralNetwork.h"
+
+#include <iostream>
+#include <string>
+
+// Trains a network with a topology fixed at compile time on XOR, and prints
+// its output for every example, e.g.
+//
+//   xor_static
+//   xor_static networks/my_xor
+//
+// Given a network folder (topology 2 3 1, tanh sigmoid), its saved weights
+// are loaded instead of training. Returns 1 unless all four are right.
+
+typedef StaticNeuralNetwork<TANH, SIGMOID, 2, 3, 1> XorNetwork;
+
+void print_error(std::string msg) {
+  // print error message, with some nice ANSI colors, if supported
+  std::cout << "\033[1;31m"<< "[ERROR] " << msg << "\033[0m" << std::endl;
+}
+
+void print_info(std::string msg) {
+  // print info message, with some nice ANSI colors, if supported
+  std::cout << "\033[1;32m"<< "[INFO] " << msg << "\033[0m" << std::endl;
+}
+
+int main(int argc, char **argv) {
+  XorNetwork::Input inputs[4];
+  XorNetwork::Output expected[4];
+
+  for (int example = 0; example < 4; example++) {
+    inputs[example] << Scalar(example / 2), Scalar(example % 2);
+    expected[example] << Scalar((example / 2) ^ (example % 2));
+  }
+
+  XorNetwork network;
+
+  if (argc > 1) {
+    if (!network.load(argv[1])) {
+      print_error(std::string(argv[1]) + " does not hold a trained 2 3 1 tanh sigmoid network.");
+      return 1;
+    }
+  } else {
+    Scalar error = 0;
+
+    for (int epoch = 0; epoch < 10000; epoch++) {
+      error = 0;
+
+      for (int example = 0; example < 4; example++)
+        error += network.teach(inputs[example], expected[example], 0.1);
+    }
+
+    print_info("Trained on XOR, error " + std::to_string(error) + " in the last epoch.");
+  }
+
+  int correct = 0;
+
+  for (int example = 0; example < 4; example++) {
+    Scalar output = network.generate(inputs[example])(0);
+
+    std::cout << inputs[example] << " -> " << output << std::endl;
+
+    if ((output > 0.5) == (expected[example](0) > 0.5))
+      correct++;
+  }
+
+  return correct == 4 ? 0 : 1;
+}